@@ -0,0 +1,200 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <voice_allocator.h>
+#include <voice_scan.h>
+
+using namespace VoiceAllocator;
+
+static const size_t Iterations = 2000000;
+
+static uint32_t random_next(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+template <typename Fn> static double measure_ns(Fn fn) {
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    size_t result = fn();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    // Keep the result alive so the loop is not optimized out
+    volatile size_t sink = result;
+    (void)sink;
+
+    return std::chrono::duration<double, std::nano>(end - begin).count() / Iterations;
+}
+
+template <size_t N> static void bench_note_lookup() {
+    // Every voice holds its own value, so a query first matches where it is looked up.
+    // InvalidNote stays the sentinel of a free voice.
+    VoiceNote notes[N];
+    for(size_t i = 0; i < N; i++) {
+        notes[i] = i < Constants::InvalidNote ? (VoiceNote)i : Constants::InvalidNote;
+    }
+    const size_t held = N < Constants::InvalidNote ? N : Constants::InvalidNote;
+
+    // Look up notes held by voices in the upper half, as a poly note_off would
+    VoiceNote queries[256];
+    uint32_t state = 0x12345678;
+    for(size_t i = 0; i < 256; i++) {
+        queries[i] = notes[N / 2 + random_next(state) % (held - N / 2)];
+    }
+
+    double scalar = measure_ns([&]() {
+        size_t sum = 0;
+        for(size_t i = 0; i < Iterations; i++) {
+            sum += Scan::find_byte_scalar(notes, N, queries[i & 255]);
+        }
+        return sum;
+    });
+
+    double simd = measure_ns([&]() {
+        size_t sum = 0;
+        for(size_t i = 0; i < Iterations; i++) {
+            sum += Scan::find_byte(notes, N, queries[i & 255]);
+        }
+        return sum;
+    });
+
+    std::cout << std::setw(8) << N << std::setw(14) << std::fixed << std::setprecision(2)
+              << scalar << std::setw(14) << simd << std::setw(10) << std::setprecision(1)
+              << scalar / simd << "x" << std::endl;
+}
+
+template <size_t N> static double bench_note_on_off(Strategy strategy) {
+    VoiceManager<N> voice_manager;
+    voice_manager.set_strategy(strategy);
+
+    // Keep every voice busy, then release and restrike random notes
+    for(size_t i = 0; i < N; i++) {
+        voice_manager.note_on(i % Constants::MaxNotes);
+    }
+
+    return measure_ns([&]() {
+        uint32_t state = 0x87654321;
+        for(size_t i = 0; i < Iterations; i++) {
+            VoiceNote note = random_next(state) % Constants::MaxNotes;
+            voice_manager.note_off(note);
+            voice_manager.note_on(note);
+        }
+        return (size_t)state;
+    });
+}
+
+template <size_t N> static void bench_note_on_off() {
+    double lru = bench_note_on_off<N>(Strategy::PolyLeastRecentlyUsed);
+    double round_robin = bench_note_on_off<N>(Strategy::PolyRoundRobin);
+
+    std::cout << std::setw(8) << N << std::setw(14) << std::fixed << std::setprecision(2) << lru
+              << std::setw(14) << round_robin << std::endl;
+}
+
+struct CountingVoice {
+    size_t events;
+};
+
+static void counting_start(void* context, VoiceNote) {
+    ((CountingVoice*)context)->events++;
+}
+
+static void counting_stop(void* context) {
+    ((CountingVoice*)context)->events++;
+}
+
+static void counting_start_all(void* context, VoiceNote, VoiceVelocity) {
+    ((CountingVoice*)context)->events++;
+}
+
+struct CountingSink {
+    CountingVoice* voices;
+
+    void start(size_t voice, VoiceNote, VoiceVelocity) {
+        voices[voice].events++;
+    }
+
+    void cont(size_t voice, VoiceNote, VoiceVelocity) {
+        voices[voice].events++;
+    }
+
+    void stop(size_t voice) {
+        voices[voice].events++;
+    }
+
+    void expression(size_t voice, VoiceExpression, VoiceExpressionValue) {
+        voices[voice].events++;
+    }
+};
+
+template <class Manager> static double bench_unison_events(Manager& voice_manager) {
+    voice_manager.set_strategy(Strategy::UnisonNewestNote);
+
+    return measure_ns([&]() {
+        uint32_t state = 0x13572468;
+        for(size_t i = 0; i < Iterations; i++) {
+            VoiceNote note = random_next(state) % Constants::MaxNotes;
+            voice_manager.note_on(note);
+            voice_manager.note_off(note);
+        }
+        return (size_t)state;
+    });
+}
+
+template <size_t N> static void bench_output() {
+    CountingVoice voices[N] = {};
+
+    VoiceManager<N> callback_manager;
+    VoiceOutputCallbacks callbacks[N];
+    void* context[N];
+    for(size_t i = 0; i < N; i++) {
+        callbacks[i] = {.start = counting_start, .cont = counting_start, .stop = counting_stop};
+        context[i] = &voices[i];
+    }
+    callback_manager.set_output_callbacks(callbacks, context);
+
+    CountingSink sink = {voices};
+    VoiceManager<N, DynamicStrategy, CountingSink> sink_manager(sink);
+
+    VoiceManager<N> broadcast_manager;
+    VoiceOutputBroadcastCallbacks broadcast = {
+        .start_all = counting_start_all,
+        .cont_all = counting_start_all,
+        .stop_all = counting_stop};
+    broadcast_manager.set_broadcast_callbacks(broadcast, &voices[0]);
+
+    double callback_ns = bench_unison_events(callback_manager);
+    double sink_ns = bench_unison_events(sink_manager);
+    double broadcast_ns = bench_unison_events(broadcast_manager);
+
+    std::cout << std::setw(8) << N << std::setw(14) << std::fixed << std::setprecision(2)
+              << callback_ns << std::setw(14) << sink_ns << std::setw(14) << broadcast_ns
+              << std::endl;
+}
+
+int main() {
+    std::cout << "Note lookup over VoiceNote[N], ns per lookup" << std::endl;
+    std::cout << "  voices        scalar          simd   speedup" << std::endl;
+    bench_note_lookup<32>();
+    bench_note_lookup<64>();
+    bench_note_lookup<128>();
+    bench_note_lookup<256>();
+
+    std::cout << std::endl;
+    std::cout << "Indexed poly note_off + note_on, ns per pair" << std::endl;
+    std::cout << "  voices           lru   round robin" << std::endl;
+    bench_note_on_off<32>();
+    bench_note_on_off<64>();
+    bench_note_on_off<128>();
+    bench_note_on_off<256>();
+
+    std::cout << std::endl;
+    std::cout << "Unison note_on + note_off output, ns per pair" << std::endl;
+    std::cout << "  voices     callbacks          sink     broadcast" << std::endl;
+    bench_output<1>();
+    bench_output<4>();
+    bench_output<16>();
+
+    return 0;
+}
@@ -2,80 +2,1280 @@
 
 #include <stdint.h>
 #include <stdlib.h>
-#include <numeric>
 #include <algorithm>
 #include <cstring>
+#include <type_traits>
+#include <utility>
+#include "voice_bitset.h"
 
 namespace VoiceAllocator {
 
 typedef uint8_t VoiceNote;
 
+/** Note velocity with MIDI 2.0 16-bit resolution */
+typedef uint16_t VoiceVelocity;
+
+/** Loudness of a voice as reported by the synth, same scale as VoiceVelocity */
+typedef uint16_t VoiceLevel;
+
+/** MIDI channel, from 0 */
+typedef uint8_t VoiceChannel;
+
+/** Identity of a sounding note: the same note number on two channels is two notes */
+struct NoteId {
+    VoiceChannel channel;
+    VoiceNote note;
+};
+
+/** Per-note expression routed to the voice that plays the note */
+enum VoiceExpression : uint8_t {
+    ExpressionPressure,
+    ExpressionPitchBend,
+    ExpressionTimbre,
+};
+
+/** Expression value with MIDI 2.0 16-bit resolution */
+typedef uint16_t VoiceExpressionValue;
+
 namespace Constants {
 const size_t MaxNotes = 128;
+const size_t MaxChannels = 16;
 const VoiceNote InvalidNote = UINT8_MAX;
 const size_t InvalidVoice = SIZE_MAX;
+
+/** VoiceCount of a VoiceManager sized at run time, see VoiceManager::set_voices() */
+const size_t DynamicVoiceCount = 0;
+
+/** Alignment of the arena memory given to a runtime sized VoiceManager */
+const size_t ArenaAlignment = alignof(uint64_t) > alignof(void*) ? alignof(uint64_t) :
+                                                                   alignof(void*);
+
+/** Cache line size assumed to keep state of different threads apart */
+const size_t CacheLineSize = 64;
+
+/** MIDI 1.0 velocity 64 */
+const VoiceVelocity DefaultVelocity = 0x8000;
+
+/** Pitch bend expression value for no bend */
+const VoiceExpressionValue PitchBendCenter = 0x8000;
+}
+
+/** Scale a MIDI 1.0 7-bit velocity to 16 bits, as the MIDI 2.0 translation rules do */
+inline VoiceVelocity velocity_from_7bit(uint8_t velocity) {
+    velocity &= 0x7F;
+    uint32_t scaled = (uint32_t)velocity << 9;
+    if(velocity > 64) {
+        // Repeat the lower 6 bits to reach the full range while keeping 64 at the center
+        uint32_t repeat = (uint32_t)(velocity & 0x3F) << 3;
+        while(repeat) {
+            scaled |= repeat;
+            repeat >>= 6;
+        }
+    }
+    return (VoiceVelocity)scaled;
+}
+
+/** Scale a 16-bit velocity down to MIDI 1.0 7 bits */
+inline uint8_t velocity_to_7bit(VoiceVelocity velocity) {
+    return velocity >> 9;
+}
+
+/** Start a new note (set note and open gate) */
+typedef void (*VoiceOutputStartCallback)(void*, VoiceNote);
+
+/** Continue old note (set note and do retrigger) */
+typedef void (*VoiceOutputСontinueCallback)(void*, VoiceNote);
+
+/** Stop a note (close gate) */
+typedef void (*VoiceOutputStopCallback)(void*);
+
+/** Start a new note with velocity, used instead of start when set */
+typedef void (*VoiceOutputStartVelocityCallback)(void*, VoiceNote, VoiceVelocity);
+
+/** Continue old note with velocity, used instead of cont when set */
+typedef void (*VoiceOutputContinueVelocityCallback)(void*, VoiceNote, VoiceVelocity);
+
+/** Expression change for the note the voice plays */
+typedef void (*VoiceOutputExpressionCallback)(void*, VoiceExpression, VoiceExpressionValue);
+
+/** Start every voice on the note, used by unison strategies instead of the per-voice calls */
+typedef void (*VoiceOutputStartAllCallback)(void*, VoiceNote, VoiceVelocity);
+
+/** Continue every voice with the note, used by unison strategies */
+typedef void (*VoiceOutputContinueAllCallback)(void*, VoiceNote, VoiceVelocity);
+
+/** Stop every voice, used by unison strategies */
+typedef void (*VoiceOutputStopAllCallback)(void*);
+
+/** Callbacks for the voice manager to use to output notes */
+struct VoiceOutputCallbacks {
+    VoiceOutputStartCallback start;
+    VoiceOutputСontinueCallback cont;
+    VoiceOutputStopCallback stop;
+    VoiceOutputStartVelocityCallback start_velocity;
+    VoiceOutputContinueVelocityCallback cont_velocity;
+    VoiceOutputExpressionCallback expression;
+};
+
+/** Callbacks that drive every voice at once, each one that is not set falls back per voice */
+struct VoiceOutputBroadcastCallbacks {
+    VoiceOutputStartAllCallback start_all;
+    VoiceOutputContinueAllCallback cont_all;
+    VoiceOutputStopAllCallback stop_all;
+};
+
+/** Carves aligned arrays out of an arena, or only counts the bytes when the arena is null */
+class ArenaLayout {
+public:
+    explicit ArenaLayout(void* memory)
+        : _memory((uint8_t*)memory)
+        , _size(0) {
+    }
+
+    template <class T> T* take(size_t count) {
+        _size = (_size + alignof(T) - 1) / alignof(T) * alignof(T);
+        T* items = _memory ? (T*)(_memory + _size) : nullptr;
+        _size += count * sizeof(T);
+        return items;
+    }
+
+    /** Bytes taken so far, rounded up so that the next layout can follow */
+    size_t size() const {
+        return (_size + Constants::ArenaAlignment - 1) / Constants::ArenaAlignment *
+               Constants::ArenaAlignment;
+    }
+
+private:
+    uint8_t* _memory;
+    size_t _size;
+};
+
+/** Per-voice callbacks of CallbackSink, sized at compile time */
+template <size_t VoiceCount> class CallbackStorage {
+public:
+    size_t voice_count() const {
+        return VoiceCount;
+    }
+
+protected:
+    VoiceOutputCallbacks _callbacks[VoiceCount];
+    void* _context[VoiceCount];
+};
+
+/** Per-voice callbacks of CallbackSink in arena memory */
+template <> class CallbackStorage<Constants::DynamicVoiceCount> {
+public:
+    CallbackStorage()
+        : _callbacks(nullptr)
+        , _context(nullptr)
+        , _voice_count(0) {
+    }
+
+    size_t voice_count() const {
+        return _voice_count;
+    }
+
+    static size_t required_bytes(size_t voices) {
+        CallbackStorage storage;
+        return storage.layout(nullptr, voices);
+    }
+
+    /** Use memory[required_bytes(voices)], the callbacks are cleared */
+    void bind(void* memory, size_t voices) {
+        layout(memory, voices);
+        _voice_count = voices;
+        VoiceOutputCallbacks none = {};
+        std::fill_n(_callbacks, voices, none);
+        std::fill_n(_context, voices, nullptr);
+    }
+
+protected:
+    VoiceOutputCallbacks* _callbacks;
+    void** _context;
+
+private:
+    size_t _voice_count;
+
+    size_t layout(void* memory, size_t voices) {
+        ArenaLayout arena(memory);
+        _callbacks = arena.take<VoiceOutputCallbacks>(voices);
+        _context = arena.take<void*>(voices);
+        return arena.size();
+    }
+};
+
+/**
+ * Sink that forwards voice events to per-voice VoiceOutputCallbacks.
+ * Any class with the same start/cont/stop/expression members can be used as a VoiceManager sink,
+ * so the synth voice update inlines directly into the allocator instead.
+ */
+template <size_t VoiceCount> class CallbackSink : public CallbackStorage<VoiceCount> {
+public:
+    CallbackSink()
+        : _broadcast()
+        , _broadcast_context(nullptr) {
+        VoiceOutputCallbacks none = {};
+        std::fill_n(_callbacks, this->voice_count(), none);
+        std::fill_n(_context, this->voice_count(), nullptr);
+    }
+
+    void set_broadcast_callbacks(const VoiceOutputBroadcastCallbacks& callbacks, void* context) {
+        _broadcast = callbacks;
+        _broadcast_context = context;
+    }
+
+    /** Copy callbacks[voice_count()] and context[voice_count()] */
+    void set_output_callbacks(VoiceOutputCallbacks* callbacks, void** context) {
+        std::copy(callbacks, callbacks + this->voice_count(), _callbacks);
+        std::copy(context, context + this->voice_count(), _context);
+    }
+
+    void start(size_t voice, VoiceNote note, VoiceVelocity velocity) {
+        if(_callbacks[voice].start_velocity) {
+            _callbacks[voice].start_velocity(_context[voice], note, velocity);
+        } else if(_callbacks[voice].start) {
+            _callbacks[voice].start(_context[voice], note);
+        }
+    }
+
+    void cont(size_t voice, VoiceNote note, VoiceVelocity velocity) {
+        if(_callbacks[voice].cont_velocity) {
+            _callbacks[voice].cont_velocity(_context[voice], note, velocity);
+        } else if(_callbacks[voice].cont) {
+            _callbacks[voice].cont(_context[voice], note);
+        }
+    }
+
+    void stop(size_t voice) {
+        if(_callbacks[voice].stop) {
+            _callbacks[voice].stop(_context[voice]);
+        }
+    }
+
+    void expression(size_t voice, VoiceExpression type, VoiceExpressionValue value) {
+        if(_callbacks[voice].expression) {
+            _callbacks[voice].expression(_context[voice], type, value);
+        }
+    }
+
+    void start_all(VoiceNote note, VoiceVelocity velocity) {
+        if(_broadcast.start_all) {
+            _broadcast.start_all(_broadcast_context, note, velocity);
+            return;
+        }
+        for(size_t i = 0; i < this->voice_count(); i++) {
+            start(i, note, velocity);
+        }
+    }
+
+    void cont_all(VoiceNote note, VoiceVelocity velocity) {
+        if(_broadcast.cont_all) {
+            _broadcast.cont_all(_broadcast_context, note, velocity);
+            return;
+        }
+        for(size_t i = 0; i < this->voice_count(); i++) {
+            cont(i, note, velocity);
+        }
+    }
+
+    void stop_all() {
+        if(_broadcast.stop_all) {
+            _broadcast.stop_all(_broadcast_context);
+            return;
+        }
+        for(size_t i = 0; i < this->voice_count(); i++) {
+            stop(i);
+        }
+    }
+
+private:
+    using CallbackStorage<VoiceCount>::_callbacks;
+    using CallbackStorage<VoiceCount>::_context;
+
+    VoiceOutputBroadcastCallbacks _broadcast;
+    void* _broadcast_context;
+};
+
+/**
+ * Whether a sink drives every voice at once with start_all(note, velocity),
+ * cont_all(note, velocity) and stop_all(). Unison strategies then make one call per note
+ * change, other sinks get one call per voice.
+ */
+template <class Sink> class SinkBroadcasts {
+    template <class S> static char test(decltype(&S::stop_all));
+    template <class S> static long test(...);
+
+public:
+    static const bool value = sizeof(test<Sink>(nullptr)) == sizeof(char);
+};
+
+/**
+ * Arena hooks for the sink of a runtime sized VoiceManager: the bytes the sink needs for
+ * voices, and binding it to them. Sinks without per-voice state need none, overload both for
+ * one that has.
+ */
+template <class Sink> size_t sink_arena_bytes(const Sink*, size_t) {
+    return 0;
+}
+
+template <class Sink> void sink_arena_bind(Sink&, void*, size_t) {
+}
+
+inline size_t sink_arena_bytes(const CallbackSink<Constants::DynamicVoiceCount>*, size_t voices) {
+    return CallbackStorage<Constants::DynamicVoiceCount>::required_bytes(voices);
+}
+
+inline void sink_arena_bind(
+    CallbackSink<Constants::DynamicVoiceCount>& sink,
+    void* memory,
+    size_t voices) {
+    sink.bind(memory, voices);
+}
+
+/** MIDI controllers handled by VoiceManager::control_change() */
+namespace Controllers {
+const uint8_t Sustain = 64;
+const uint8_t Sostenuto = 66;
+
+/** MPE third dimension, sent as ExpressionTimbre */
+const uint8_t Timbre = 74;
+}
+
+/** Note event for VoiceManager::process() */
+struct InputEvent {
+    enum Type : uint8_t {
+        NoteOn,
+        NoteOff,
+        /** note holds the controller number, velocity the 7-bit value */
+        ControlChange,
+        /** velocity holds the 16-bit pressure */
+        PolyPressure,
+        /** Channel wide, velocity holds the 16-bit pressure */
+        ChannelPressure,
+        /** Channel wide, velocity holds the 16-bit bend */
+        PitchBend,
+    };
+
+    Type type;
+    VoiceNote note;
+
+    /** Note on velocity */
+    VoiceVelocity velocity;
+
+    /** Sample offset within the audio block, events must be in offset order */
+    uint32_t offset;
+
+    /** MIDI channel, poly strategies tell notes apart by it */
+    VoiceChannel channel;
+};
+
+/** Voice event written by EventBufferSink */
+struct OutputEvent {
+    enum Type : uint8_t {
+        Start,
+        Continue,
+        Stop,
+        /** note holds the VoiceExpression, velocity the value */
+        Expression,
+    };
+
+    uint16_t voice;
+    Type type;
+    VoiceNote note;
+    VoiceVelocity velocity;
+
+    /** Sample offset of the input event that caused this event */
+    uint32_t offset;
+};
+
+/** Sink that appends voice events to a caller supplied OutputEvent buffer */
+class EventBufferSink {
+public:
+    EventBufferSink()
+        : _events(nullptr)
+        , _capacity(0)
+        , _size(0)
+        , _dropped(0)
+        , _offset(0) {
+    }
+
+    /** Start writing to events[capacity], clears the event count and the offset */
+    void set_buffer(OutputEvent* events, size_t capacity) {
+        _events = events;
+        _capacity = capacity;
+        _size = 0;
+        _dropped = 0;
+        _offset = 0;
+    }
+
+    /** Sample offset stamped on the following events */
+    void set_offset(uint32_t offset) {
+        _offset = offset;
+    }
+
+    uint32_t offset() const {
+        return _offset;
+    }
+
+    /** Number of events written */
+    size_t size() const {
+        return _size;
+    }
+
+    /** Number of events that did not fit in the buffer */
+    size_t dropped() const {
+        return _dropped;
+    }
+
+    void start(size_t voice, VoiceNote note, VoiceVelocity velocity) {
+        push(voice, OutputEvent::Start, note, velocity);
+    }
+
+    void cont(size_t voice, VoiceNote note, VoiceVelocity velocity) {
+        push(voice, OutputEvent::Continue, note, velocity);
+    }
+
+    void stop(size_t voice) {
+        push(voice, OutputEvent::Stop, Constants::InvalidNote, 0);
+    }
+
+    void expression(size_t voice, VoiceExpression type, VoiceExpressionValue value) {
+        push(voice, OutputEvent::Expression, type, value);
+    }
+
+private:
+    OutputEvent* _events;
+    size_t _capacity;
+    size_t _size;
+    size_t _dropped;
+    uint32_t _offset;
+
+    void push(size_t voice, OutputEvent::Type type, VoiceNote note, VoiceVelocity velocity) {
+        if(_size < _capacity) {
+            OutputEvent& event = _events[_size++];
+            event.voice = (uint16_t)voice;
+            event.type = type;
+            event.note = note;
+            event.velocity = velocity;
+            event.offset = _offset;
+        } else {
+            _dropped++;
+        }
+    }
+};
+
+/** Voice lifecycle */
+enum VoiceState {
+    /** Silent, free to allocate */
+    VoiceIdle,
+    /** Playing a note */
+    VoiceActive,
+    /** Note stopped, still ringing out until the synth reports it finished */
+    VoiceReleasing,
+};
+
+enum MpeZone {
+    MpeNoZone,
+    MpeLowerZone,
+    MpeUpperZone,
+};
+
+/**
+ * MPE zone layout. The lower zone has master channel 0 and member channels 1 and up,
+ * the upper zone has master channel 15 and member channels 14 and down.
+ */
+class MpeLayout {
+public:
+    MpeLayout()
+        : _lower_members(0)
+        , _upper_members(0) {
+    }
+
+    /**
+     * Set the member channel counts, 0 disables a zone. A zone alone may have 15 members,
+     * two zones share 14. The lower zone wins on overlap and the upper zone shrinks.
+     */
+    void set_zones(uint8_t lower_members, uint8_t upper_members) {
+        const uint8_t max_members = Constants::MaxChannels - 1;
+        _lower_members = lower_members < max_members ? lower_members : max_members;
+        _upper_members = upper_members < max_members ? upper_members : max_members;
+        if(_lower_members > 0 && _lower_members + _upper_members > max_members - 1) {
+            _upper_members =
+                _lower_members >= max_members - 1 ? 0 : max_members - 1 - _lower_members;
+        }
+    }
+
+    bool enabled() const {
+        return _lower_members > 0 || _upper_members > 0;
+    }
+
+    /** Member channel count of the zone, 0 when it is disabled */
+    uint8_t members(MpeZone zone) const {
+        if(zone == MpeLowerZone) {
+            return _lower_members;
+        }
+        return zone == MpeUpperZone ? _upper_members : 0;
+    }
+
+    /** Zone the channel belongs to, as master or member */
+    MpeZone zone(VoiceChannel channel) const {
+        if(_lower_members > 0 && channel <= _lower_members) {
+            return MpeLowerZone;
+        }
+        if(_upper_members > 0 && channel >= Constants::MaxChannels - 1 - _upper_members &&
+           channel < Constants::MaxChannels) {
+            return MpeUpperZone;
+        }
+        return MpeNoZone;
+    }
+
+    VoiceChannel master(MpeZone zone) const {
+        return zone == MpeUpperZone ? Constants::MaxChannels - 1 : 0;
+    }
+
+    bool is_master(VoiceChannel channel) const {
+        MpeZone channel_zone = zone(channel);
+        return channel_zone != MpeNoZone && channel == master(channel_zone);
+    }
+
+private:
+    uint8_t _lower_members;
+    uint8_t _upper_members;
+};
+
+enum Strategy {
+    UnisonHighestNote,
+    UnisonLowestNote,
+    UnisonNewestNote,
+    UnisonOldestNote,
+    PolyLeastRecentlyUsed,
+    PolyMostRecentlyUsed,
+    /** Steal the voice with the lowest level reported by set_voice_level() */
+    PolyQuietestVoice,
+    /** Cycle through the voices like an analog poly, skipping busy ones, no recency tracking */
+    PolyRoundRobin,
+    /**
+     * Poly with a group of stack_size() voices per note, e.g. for detuned stacks. Groups are
+     * allocated and stolen as a whole, least recently used first. A voice is member
+     * voice % stack_size() of its group.
+     */
+    PolyStacked,
+};
+
+constexpr bool is_unison_strategy(Strategy strategy) {
+    return strategy == UnisonHighestNote || strategy == UnisonLowestNote ||
+           strategy == UnisonNewestNote || strategy == UnisonOldestNote;
+}
+
+/** Held notes in push order, for the unison strategies */
+class NoteStack {
+public:
+    NoteStack() {
+        reset();
+    }
+
+    void reset() {
+        _top = Constants::InvalidNote;
+        _bottom = Constants::InvalidNote;
+        _held.reset();
+        _deferred.reset();
+        _sostenuto.reset();
+        std::fill_n(_prev, Constants::MaxNotes, Constants::InvalidNote);
+        std::fill_n(_next, Constants::MaxNotes, Constants::InvalidNote);
+        std::fill_n(_channel, Constants::MaxNotes, 0);
+    }
+
+    /** Push a note on top, a note that is already held is moved to the top with its key down */
+    void push(VoiceNote note, VoiceVelocity velocity, VoiceChannel channel) {
+        pop(note);
+        _velocity[note] = velocity;
+        _channel[note] = channel;
+
+        _prev[note] = _top;
+        _next[note] = Constants::InvalidNote;
+        if(_top != Constants::InvalidNote) {
+            _next[_top] = note;
+        } else {
+            _bottom = note;
+        }
+        _top = note;
+        _held.set(note);
+    }
+
+    void pop(VoiceNote note) {
+        if(!_held.test(note)) {
+            return;
+        }
+
+        VoiceNote prev = _prev[note];
+        VoiceNote next = _next[note];
+        if(prev != Constants::InvalidNote) {
+            _next[prev] = next;
+        } else {
+            _bottom = next;
+        }
+        if(next != Constants::InvalidNote) {
+            _prev[next] = prev;
+        } else {
+            _top = prev;
+        }
+
+        _prev[note] = Constants::InvalidNote;
+        _next[note] = Constants::InvalidNote;
+        _held.clear(note);
+        _deferred.clear(note);
+    }
+
+    VoiceNote top() {
+        return _top;
+    }
+
+    VoiceNote bottom() {
+        return _bottom;
+    }
+
+    bool empty() {
+        return _top == Constants::InvalidNote;
+    }
+
+    /** Held note pushed just before the note, or InvalidNote */
+    VoiceNote below(VoiceNote note) {
+        return _prev[note];
+    }
+
+    /** Held note pushed just after the note, or InvalidNote */
+    VoiceNote above(VoiceNote note) {
+        return _next[note];
+    }
+
+    VoiceNote get_highest_note() {
+        if(empty()) {
+            return 0;
+        }
+        return _held.find_last();
+    }
+
+    VoiceNote get_lowest_note() {
+        if(empty()) {
+            return Constants::MaxNotes - 1;
+        }
+        return _held.find_first();
+    }
+
+    /** Velocity the held note was pushed with */
+    VoiceVelocity velocity(VoiceNote note) {
+        return _velocity[note];
+    }
+
+    /** Channel the held note was pushed on last */
+    VoiceChannel channel(VoiceNote note) {
+        return _channel[note];
+    }
+
+    void set_channel(VoiceNote note, VoiceChannel channel) {
+        _channel[note] = channel;
+    }
+
+    /** The key of the held note went up while a pedal holds it */
+    void defer(VoiceNote note) {
+        if(_held.test(note)) {
+            _deferred.set(note);
+        }
+    }
+
+    bool deferred(VoiceNote note) {
+        return _deferred.test(note);
+    }
+
+    /** The note was held with its key down when the sostenuto pedal went down */
+    bool sostenuto(VoiceNote note) {
+        return _sostenuto.test(note);
+    }
+
+    void capture_sostenuto() {
+        _sostenuto = _held;
+        _sostenuto.clear(_deferred);
+    }
+
+    void release_sostenuto() {
+        _sostenuto.reset();
+    }
+
+    /** Pedal up: the deferred notes, without those sostenuto still holds with keep_sostenuto */
+    BitSet<Constants::MaxNotes> take_deferred(bool keep_sostenuto) {
+        BitSet<Constants::MaxNotes> released = _deferred;
+        if(keep_sostenuto) {
+            released.clear(_sostenuto);
+        }
+        _deferred.clear(released);
+        return released;
+    }
+
+private:
+    /** Push order as a doubly linked list over notes, from _bottom (oldest) to _top (newest) */
+    VoiceNote _prev[Constants::MaxNotes];
+    VoiceNote _next[Constants::MaxNotes];
+    VoiceNote _top;
+    VoiceNote _bottom;
+
+    /** Bitmap of the held notes, a note is in the list only if its bit is set */
+    BitSet<Constants::MaxNotes> _held;
+
+    /** Held notes whose key is up while a pedal holds them */
+    BitSet<Constants::MaxNotes> _deferred;
+
+    /** Notes whose key was down when the sostenuto pedal went down */
+    BitSet<Constants::MaxNotes> _sostenuto;
+
+    VoiceVelocity _velocity[Constants::MaxNotes];
+    VoiceChannel _channel[Constants::MaxNotes];
+};
+
+/** Stand-in for NoteStack in managers whose strategy never holds notes */
+class NullNoteStack {
+public:
+    void reset() {
+    }
+
+    void push(VoiceNote, VoiceVelocity, VoiceChannel) {
+    }
+
+    void pop(VoiceNote) {
+    }
+
+    VoiceNote top() {
+        return Constants::InvalidNote;
+    }
+
+    VoiceNote bottom() {
+        return Constants::InvalidNote;
+    }
+
+    bool empty() {
+        return true;
+    }
+
+    VoiceNote below(VoiceNote) {
+        return Constants::InvalidNote;
+    }
+
+    VoiceNote above(VoiceNote) {
+        return Constants::InvalidNote;
+    }
+
+    VoiceNote get_highest_note() {
+        return 0;
+    }
+
+    VoiceNote get_lowest_note() {
+        return Constants::MaxNotes - 1;
+    }
+
+    VoiceVelocity velocity(VoiceNote) {
+        return Constants::DefaultVelocity;
+    }
+
+    VoiceChannel channel(VoiceNote) {
+        return 0;
+    }
+
+    void set_channel(VoiceNote, VoiceChannel) {
+    }
+
+    void defer(VoiceNote) {
+    }
+
+    bool deferred(VoiceNote) {
+        return false;
+    }
+
+    bool sostenuto(VoiceNote) {
+        return false;
+    }
+
+    void capture_sostenuto() {
+    }
+
+    void release_sostenuto() {
+    }
+};
+
+/** Strategy chosen at runtime with set_strategy() */
+class DynamicStrategy {
+public:
+    DynamicStrategy()
+        : _strategy(UnisonHighestNote)
+        , _stack_size(1) {
+    }
+
+    /** Whether the policy can ever run the strategy, so state only it needs can be left out */
+    static constexpr bool may_use(Strategy) {
+        return true;
+    }
+
+    Strategy strategy() const {
+        return _strategy;
+    }
+
+    void set_strategy(Strategy strategy) {
+        _strategy = strategy;
+    }
+
+    /** Voices per note for PolyStacked */
+    size_t stack_size() const {
+        return _stack_size;
+    }
+
+    void set_stack_size(size_t voices) {
+        _stack_size = voices > 0 ? voices : 1;
+    }
+
+    NoteStack& note_stack() {
+        return _note_stack;
+    }
+
+private:
+    Strategy _strategy;
+    size_t _stack_size;
+    NoteStack _note_stack;
+};
+
+/**
+ * Strategy fixed at compile time: the strategy switch folds to a single branch and
+ * poly strategies carry no NoteStack
+ */
+template <Strategy S, bool Unison = is_unison_strategy(S)> class FixedStrategy {
+public:
+    static constexpr bool may_use(Strategy strategy) {
+        return strategy == S;
+    }
+
+    Strategy strategy() const {
+        return S;
+    }
+
+    size_t stack_size() const {
+        return 1;
+    }
+
+    NoteStack& note_stack() {
+        return _note_stack;
+    }
+
+private:
+    NoteStack _note_stack;
+};
+
+template <Strategy S> class FixedStrategy<S, false> {
+public:
+    static_assert(S != PolyStacked, "Use StackedStrategy<K> for a fixed PolyStacked");
+
+    static constexpr bool may_use(Strategy strategy) {
+        return strategy == S;
+    }
+
+    Strategy strategy() const {
+        return S;
+    }
+
+    size_t stack_size() const {
+        return 1;
+    }
+
+    NullNoteStack note_stack() {
+        return NullNoteStack();
+    }
+};
+
+/** PolyStacked with K voices per note fixed at compile time */
+template <size_t K> class StackedStrategy {
+public:
+    static_assert(K > 0, "A stack needs a voice");
+
+    static constexpr bool may_use(Strategy strategy) {
+        return strategy == PolyStacked;
+    }
+
+    Strategy strategy() const {
+        return PolyStacked;
+    }
+
+    size_t stack_size() const {
+        return K;
+    }
+
+    NullNoteStack note_stack() {
+        return NullNoteStack();
+    }
+};
+
+/** Smallest unsigned type for the voice indices of VoiceCount voices and a sentinel */
+template <size_t VoiceCount> struct VoiceIndexType {
+    typedef typename std::conditional<
+        (VoiceCount < UINT8_MAX),
+        uint8_t,
+        typename std::conditional<(VoiceCount < UINT16_MAX), uint16_t, size_t>::type>::type Type;
+};
+
+/** A runtime sized manager has up to UINT16_MAX - 1 voices */
+template <> struct VoiceIndexType<Constants::DynamicVoiceCount> {
+    typedef uint16_t Type;
+};
+
+/**
+ * Voice lists kept as index links, shared by the allocators. The sentinel is the largest
+ * value of the index type.
+ */
+namespace VoiceLinks {
+
+/** Recency order of count voices over newer/older links, voice 0 most recent */
+template <class Index>
+void order(Index* newer, Index* older, Index& most_recent, Index& least_recent, size_t count) {
+    const size_t none = (Index)~(Index)0;
+    for(size_t i = 0; i < count; i++) {
+        newer[i] = i > 0 ? i - 1 : none;
+        older[i] = i + 1 < count ? i + 1 : none;
+    }
+    most_recent = 0;
+    least_recent = count > 0 ? count - 1 : 0;
 }
 
-/** Start a new note (set note and open gate) */
-typedef void (*VoiceOutputStartCallback)(void*, VoiceNote);
+/** Move voice to the most recent end of the recency order */
+template <class Index>
+void touch(Index* newer, Index* older, Index& most_recent, Index& least_recent, size_t voice) {
+    const size_t none = (Index)~(Index)0;
+    if(voice == most_recent) {
+        return;
+    }
 
-/** Continue old note (set note and do retrigger) */
-typedef void (*VoiceOutputСontinueCallback)(void*, VoiceNote);
+    size_t next = newer[voice];
+    size_t prev = older[voice];
+    older[next] = prev;
+    if(prev != none) {
+        newer[prev] = next;
+    } else {
+        least_recent = next;
+    }
 
-/** Stop a note (close gate) */
-typedef void (*VoiceOutputStopCallback)(void*);
+    newer[voice] = none;
+    older[voice] = most_recent;
+    newer[most_recent] = voice;
+    most_recent = voice;
+}
 
-/** Callbacks for the voice manager to use to output notes */
-struct VoiceOutputCallbacks {
-    VoiceOutputStartCallback start;
-    VoiceOutputСontinueCallback cont;
-    VoiceOutputStopCallback stop;
+/** Append voice to the circular ring that first heads, so the ring keeps start order */
+template <class Index> void ring_insert(Index& first, Index* prev, Index* next, size_t voice) {
+    if(first == (Index)~(Index)0) {
+        first = voice;
+        prev[voice] = voice;
+        next[voice] = voice;
+    } else {
+        size_t last = prev[first];
+        prev[voice] = last;
+        next[voice] = first;
+        next[last] = voice;
+        prev[first] = voice;
+    }
+}
+
+/** Remove voice from the circular ring that first heads */
+template <class Index> void ring_remove(Index& first, Index* prev, Index* next, size_t voice) {
+    size_t after = next[voice];
+    if(after == voice) {
+        first = (Index)~(Index)0;
+    } else {
+        size_t before = prev[voice];
+        next[before] = after;
+        prev[after] = before;
+        if(first == voice) {
+            first = after;
+        }
+    }
+}
+
+}
+
+/**
+ * Per-voice arrays of the VoiceManager voice stack, sized at compile time.
+ * The voice stack keeps the scalars, these are the arrays a runtime sized manager moves to
+ * arena memory.
+ */
+template <size_t VoiceCount> class VoiceStorage {
+public:
+    typedef BitSet<VoiceCount> VoiceBits;
+    typedef typename VoiceIndexType<VoiceCount>::Type VoiceIndex;
+
+    /** Stored for no voice, the public interface reports Constants::InvalidVoice instead */
+    enum : VoiceIndex { NoVoice = (VoiceIndex)~(VoiceIndex)0 };
+
+    size_t voice_count() const {
+        return VoiceCount;
+    }
+
+protected:
+    // Ordered by alignment so there is no padding, the MPE channels are the coldest and last
+
+    /** Bitmap of the idle voices */
+    VoiceBits _free;
+
+    /** Bitmap of the releasing voices */
+    VoiceBits _releasing;
+
+    /**
+     * Bitmap of the playing voices whose key is up while a pedal holds them, the other
+     * playing voices have their key down
+     */
+    VoiceBits _deferred;
+
+    /** Bitmap of the voices whose key was down when the sostenuto pedal went down */
+    VoiceBits _sostenuto;
+
+    /**
+     * Voice levels and a tournament tree over them: node n holds the quieter of the winners of
+     * nodes 2n and 2n+1, nodes from voice_count() up are the voices themselves, node 1 is the
+     * quietest voice. Node 0 is unused.
+     */
+    VoiceLevel _level[VoiceCount];
+    VoiceIndex _quietest[VoiceCount];
+
+    /** Array of voice notes */
+    VoiceNote _notes[VoiceCount];
+
+    /** Recency order as a doubly linked list over voices */
+    VoiceIndex _newer[VoiceCount];
+    VoiceIndex _older[VoiceCount];
+
+    /**
+     * Note chains: the voices playing a note form a circular doubly linked list in start
+     * order. A releasing voice plays no note, so the release list reuses these slots.
+     */
+    VoiceIndex _chain_prev[VoiceCount];
+    VoiceIndex _chain_next[VoiceCount];
+
+    /** Channel of every voice's note */
+    VoiceChannel _channel[VoiceCount];
 };
 
-template <size_t VoiceCount> class VoiceManager {
+/** Per-voice arrays of the voice stack in one contiguous block of arena memory */
+template <> class VoiceStorage<Constants::DynamicVoiceCount> {
 public:
-    enum Strategy {
-        UnisonHighestNote,
-        UnisonLowestNote,
-        UnisonNewestNote,
-        UnisonOldestNote,
-        PolyLeastRecentlyUsed,
-        PolyMostRecentlyUsed,
-    };
+    typedef BitSpan VoiceBits;
+    typedef VoiceIndexType<Constants::DynamicVoiceCount>::Type VoiceIndex;
+    enum : VoiceIndex { NoVoice = (VoiceIndex)~(VoiceIndex)0 };
+
+    VoiceStorage()
+        : _newer(nullptr)
+        , _older(nullptr)
+        , _notes(nullptr)
+        , _channel(nullptr)
+        , _chain_prev(nullptr)
+        , _chain_next(nullptr)
+        , _level(nullptr)
+        , _quietest(nullptr)
+        , _voice_count(0) {
+    }
+
+    size_t voice_count() const {
+        return _voice_count;
+    }
+
+    static size_t required_bytes(size_t voices) {
+        VoiceStorage storage;
+        return storage.layout(nullptr, voices);
+    }
+
+    /** Use memory[required_bytes(voices)], the caller resets the voice stack afterwards */
+    void bind(void* memory, size_t voices) {
+        layout(memory, voices);
+        _voice_count = voices;
+    }
+
+protected:
+    VoiceIndex* _newer;
+    VoiceIndex* _older;
+    VoiceNote* _notes;
+    VoiceChannel* _channel;
+    VoiceIndex* _chain_prev;
+    VoiceIndex* _chain_next;
+    BitSpan _free;
+    BitSpan _releasing;
+    BitSpan _deferred;
+    BitSpan _sostenuto;
+    VoiceLevel* _level;
+    VoiceIndex* _quietest;
+
+private:
+    size_t _voice_count;
+
+    /** Widest types first, so the arrays need no padding between them */
+    size_t layout(void* memory, size_t voices) {
+        ArenaLayout arena(memory);
+        _free.bind(arena.take<uint64_t>(BitSpan::word_count(voices)), voices);
+        _releasing.bind(arena.take<uint64_t>(BitSpan::word_count(voices)), voices);
+        _deferred.bind(arena.take<uint64_t>(BitSpan::word_count(voices)), voices);
+        _sostenuto.bind(arena.take<uint64_t>(BitSpan::word_count(voices)), voices);
+        _newer = arena.take<VoiceIndex>(voices);
+        _older = arena.take<VoiceIndex>(voices);
+        _chain_prev = arena.take<VoiceIndex>(voices);
+        _chain_next = arena.take<VoiceIndex>(voices);
+        _quietest = arena.take<VoiceIndex>(voices);
+        _level = arena.take<VoiceLevel>(voices);
+        _notes = arena.take<VoiceNote>(voices);
+        _channel = arena.take<VoiceChannel>(voices);
+        return arena.size();
+    }
+};
+
+/**
+ * Voice manager for VoiceCount voices, or for a number set at run time with
+ * VoiceCount = Constants::DynamicVoiceCount, see set_voices().
+ * Policy is DynamicStrategy to switch strategies at runtime, or FixedStrategy<S>.
+ * Sink receives the voice events, see CallbackSink.
+ */
+template <
+    size_t VoiceCount,
+    class Policy = DynamicStrategy,
+    class Sink = CallbackSink<VoiceCount>>
+class VoiceManager : private Policy {
+public:
+    typedef VoiceAllocator::Strategy Strategy;
 
     VoiceManager() {
         reset();
     }
 
+    explicit VoiceManager(const Sink& sink)
+        : _voice_stack(sink) {
+        reset();
+    }
+
     /** Reset the voice manager */
     void reset() {
-        _note_stack.reset();
+        this->note_stack().reset();
         _voice_stack.reset();
+        _voice_stack.set_quietest_tracking(this->strategy() == PolyQuietestVoice);
+        _sustain = false;
+        _sostenuto = false;
     }
 
-    /** Set the strategy to use for voice allocation */
+    /**
+     * Set the strategy to use for voice allocation, only with DynamicStrategy.
+     * Held notes carry over in one pass over the voices and emit only the events that change
+     * what sounds: unison to poly spreads the newest held notes over the voices, poly to unison
+     * and unison to unison move every voice to the note the new strategy picks.
+     */
     void set_strategy(Strategy strategy) {
-        _strategy = strategy;
+        Strategy old_strategy = this->strategy();
+        Policy::set_strategy(strategy);
+        _voice_stack.set_quietest_tracking(strategy == PolyQuietestVoice);
+        if(voice_count() == 0) {
+            return;
+        }
+
+        if(is_unison_strategy(strategy)) {
+            if(strategy != old_strategy) {
+                unison_switch();
+            }
+        } else if(is_unison_strategy(old_strategy) || stacking_changed(old_strategy, strategy)) {
+            poly_switch(is_unison_strategy(old_strategy));
+        }
+    }
+
+    /** Voices per note for PolyStacked, at most voice_count() */
+    size_t stack_size() const {
+        size_t size = Policy::stack_size();
+        return size < voice_count() ? size : voice_count();
+    }
+
+    /** Set the voices per note for PolyStacked, only with DynamicStrategy */
+    void set_stack_size(size_t voices) {
+        Policy::set_stack_size(voices);
+        if(this->strategy() == PolyStacked && voice_count() > 0) {
+            poly_switch(false);
+        }
+    }
+
+    /** Set the callbacks[voice_count()] to use for output */
+    void set_output_callbacks(VoiceOutputCallbacks* callbacks, void** context) {
+        _voice_stack.sink().set_output_callbacks(callbacks, context);
+    }
+
+    /** Set the callbacks that unison strategies use to drive every voice in one call */
+    void set_broadcast_callbacks(const VoiceOutputBroadcastCallbacks& callbacks, void* context) {
+        _voice_stack.sink().set_broadcast_callbacks(callbacks, context);
+    }
+
+    size_t voice_count() const {
+        return _voice_stack.voice_count();
+    }
+
+    /** Arena bytes set_voices() needs for voices, only with DynamicVoiceCount */
+    static size_t required_bytes(size_t voices) {
+        static_assert(
+            VoiceCount == Constants::DynamicVoiceCount, "Only runtime sized managers use arenas");
+        return VoiceStorage<VoiceCount>::required_bytes(voices) +
+               sink_arena_bytes((const Sink*)nullptr, voices);
     }
 
-    /** Set the callbacks[VoiceCount] to use for output */
-    void set_output_callbacks(
-        VoiceOutputCallbacks callbacks[VoiceCount],
-        void* context[VoiceCount]) {
-        _voice_stack.set_output_callbacks(callbacks, context);
+    /**
+     * Lay the per-voice state for voices out in arena[bytes], aligned to
+     * Constants::ArenaAlignment, only with DynamicVoiceCount. Does not allocate, so polyphony
+     * can change on the audio thread: the sounding voices are stopped and the manager is reset,
+     * sink callbacks have to be set again. The arena must outlive its use by the manager.
+     * Returns false and keeps the old layout if the arena is too small or misaligned.
+     */
+    bool set_voices(void* arena, size_t bytes, size_t voices) {
+        static_assert(
+            VoiceCount == Constants::DynamicVoiceCount, "Only runtime sized managers use arenas");
+        if(voices == 0 || voices >= VoiceStorage<VoiceCount>::NoVoice ||
+           bytes < required_bytes(voices) ||
+           (uintptr_t)arena % Constants::ArenaAlignment) {
+            return false;
+        }
+
+        _voice_stack.for_each_playing([this](size_t voice) { _voice_stack.voice_stop(voice); });
+
+        size_t stack_bytes = VoiceStorage<VoiceCount>::required_bytes(voices);
+        _voice_stack.bind(arena, voices);
+        sink_arena_bind(_voice_stack.sink(), (uint8_t*)arena + stack_bytes, voices);
+        reset();
+        return true;
     }
 
-    /** Note on */
-    void note_on(VoiceNote note) {
+    /** The sink that receives voice events */
+    Sink& sink() {
+        return _voice_stack.sink();
+    }
+
+    /**
+     * Note on. Poly strategies tell notes apart by channel as well, unison strategies ignore
+     * the channel.
+     */
+    void note_on(
+        VoiceNote note,
+        VoiceVelocity velocity = Constants::DefaultVelocity,
+        VoiceChannel channel = 0) {
         if(note >= Constants::MaxNotes) {
             note = Constants::MaxNotes - 1;
         }
+        channel &= Constants::MaxChannels - 1;
+        if(voice_count() == 0) {
+            return;
+        }
 
-        if(strategy_is_unison()) {
-            _note_stack.push(note);
+        this->note_stack().push(note, velocity, channel);
+        if((_sustain || _sostenuto) && !is_unison_strategy(this->strategy())) {
+            // Re-strike of a key held by a pedal: retrigger the voice that still plays it
+            size_t voice = _voice_stack.get_by_key(note, channel, true);
+            if(voice != Constants::InvalidVoice) {
+                for_each_stacked(voice, [&](size_t member) {
+                    _voice_stack.voice_retrigger(member, note, velocity);
+                });
+                return;
+            }
         }
 
-        switch(_strategy) {
+        switch(this->strategy()) {
         case UnisonHighestNote:
             unison_highest_note_on();
             break;
@@ -89,25 +1289,347 @@ public:
             unison_oldest_note_on();
             break;
         case PolyLeastRecentlyUsed:
-            poly_least_recently_used_note_on(note);
+            poly_least_recently_used_note_on(note, velocity, channel);
             break;
         case PolyMostRecentlyUsed:
-            poly_most_recently_used_note_on(note);
+            poly_most_recently_used_note_on(note, velocity, channel);
+            break;
+        case PolyQuietestVoice:
+            poly_quietest_voice_note_on(note, velocity, channel);
+            break;
+        case PolyRoundRobin:
+            poly_round_robin_note_on(note, velocity, channel);
+            break;
+        case PolyStacked:
+            poly_stacked_note_on(note, velocity, channel);
             break;
         }
     }
 
-    /** Note off */
-    void note_off(VoiceNote note) {
+    /**
+     * Note off. Poly strategies let the pedals hold every voice on its own, unison strategies
+     * hold the note on any channel.
+     */
+    void note_off(VoiceNote note, VoiceChannel channel = 0) {
         if(note >= Constants::MaxNotes) {
             note = Constants::MaxNotes - 1;
         }
+        channel &= Constants::MaxChannels - 1;
+
+        if(is_unison_strategy(this->strategy())) {
+            if(pedal_holds(this->note_stack().sostenuto(note))) {
+                this->note_stack().defer(note);
+            } else {
+                this->note_stack().pop(note);
+                unison_note_off();
+            }
+            return;
+        }
+
+        size_t voice = _voice_stack.get_by_key(note, channel, false);
+        if(voice != Constants::InvalidVoice) {
+            if(pedal_holds(_voice_stack.is_sostenuto(voice))) {
+                for_each_stacked(voice, [&](size_t member) { _voice_stack.voice_defer(member); });
+            } else {
+                poly_note_off(voice);
+            }
+        }
+        note_stack_sync(note, HoldsNotes());
+    }
+
+    /** Voice that plays the note on the channel, the one playing it the longest if several */
+    size_t find_voice(NoteId id) {
+        if(id.note >= Constants::MaxNotes || id.channel >= Constants::MaxChannels) {
+            return Constants::InvalidVoice;
+        }
+        return _voice_stack.get_by_note(id.note, id.channel);
+    }
+
+    /** Voice that last started a note on the channel and still plays it, the MPE note owner */
+    size_t find_voice(VoiceChannel channel) {
+        if(channel >= Constants::MaxChannels) {
+            return Constants::InvalidVoice;
+        }
+        return _voice_stack.get_by_channel(channel);
+    }
+
+    /** Note the voice plays, note is InvalidNote for a silent voice or InvalidVoice */
+    NoteId voice_note(size_t voice) {
+        if(voice >= voice_count()) {
+            NoteId none = {0, Constants::InvalidNote};
+            return none;
+        }
+        return _voice_stack.get_note_id(voice);
+    }
+
+    /** Set the MPE zones by their member channel counts, see MpeLayout */
+    void set_mpe_zones(uint8_t lower_members, uint8_t upper_members) {
+        _mpe.set_zones(lower_members, upper_members);
+    }
+
+    const MpeLayout& mpe() const {
+        return _mpe;
+    }
+
+    /** Sustain pedal (CC64): note offs are deferred while it is down */
+    void set_sustain(bool down) {
+        if(_sustain == down) {
+            return;
+        }
+
+        _sustain = down;
+        if(!down) {
+            release_deferred();
+        }
+    }
+
+    /** Sostenuto pedal (CC66): note offs of the keys held when it goes down are deferred */
+    void set_sostenuto(bool down) {
+        if(_sostenuto == down) {
+            return;
+        }
+
+        _sostenuto = down;
+        if(down) {
+            _voice_stack.capture_sostenuto();
+            this->note_stack().capture_sostenuto();
+        } else {
+            if(!_sustain) {
+                release_deferred();
+            }
+            _voice_stack.release_sostenuto();
+            this->note_stack().release_sostenuto();
+        }
+    }
+
+    /**
+     * Control change, handles sustain, sostenuto and timbre and ignores other controllers.
+     * Timbre is routed like channel_expression().
+     */
+    void control_change(uint8_t controller, uint8_t value, VoiceChannel channel = 0) {
+        if(controller == Controllers::Sustain) {
+            set_sustain(value >= 64);
+        } else if(controller == Controllers::Sostenuto) {
+            set_sostenuto(value >= 64);
+        } else if(controller == Controllers::Timbre) {
+            channel_expression(ExpressionTimbre, velocity_from_7bit(value), channel);
+        }
+    }
+
+    /**
+     * Expression for the voices that play the note on the channel, found through the note
+     * index without a scan. Unison strategies match the note on any channel.
+     */
+    void note_expression(
+        VoiceExpression type,
+        VoiceNote note,
+        VoiceExpressionValue value,
+        VoiceChannel channel = 0) {
+        if(note >= Constants::MaxNotes) {
+            return;
+        }
+        channel &= Constants::MaxChannels - 1;
+
+        bool any_channel = is_unison_strategy(this->strategy());
+        _voice_stack.for_each_by_note(note, [&](size_t voice) {
+            if(any_channel || _voice_stack.get_note_id(voice).channel == channel) {
+                _voice_stack.voice_expression(voice, type, value);
+            }
+        });
+    }
+
+    /** Polyphonic key pressure */
+    void poly_pressure(VoiceNote note, VoiceExpressionValue value, VoiceChannel channel = 0) {
+        note_expression(ExpressionPressure, note, value, channel);
+    }
+
+    /** Per-note pitch bend, centered at Constants::PitchBendCenter */
+    void note_pitch_bend(VoiceNote note, VoiceExpressionValue value, VoiceChannel channel = 0) {
+        note_expression(ExpressionPitchBend, note, value, channel);
+    }
+
+    void note_timbre(VoiceNote note, VoiceExpressionValue value, VoiceChannel channel = 0) {
+        note_expression(ExpressionTimbre, note, value, channel);
+    }
+
+    /**
+     * Channel wide expression. On an MPE member channel it goes to the voice that owns the
+     * channel in one lookup, on an MPE master channel to every voice of the zone, otherwise to
+     * every voice playing on the channel. Unison strategies send it to every sounding voice.
+     */
+    void channel_expression(
+        VoiceExpression type,
+        VoiceExpressionValue value,
+        VoiceChannel channel) {
+        channel &= Constants::MaxChannels - 1;
+
+        bool unison = is_unison_strategy(this->strategy());
+        MpeZone zone = _mpe.zone(channel);
+        if(!unison && zone != MpeNoZone && !_mpe.is_master(channel)) {
+            size_t voice = _voice_stack.get_by_channel(channel);
+            if(voice != Constants::InvalidVoice) {
+                for_each_stacked(voice, [&](size_t member) {
+                    _voice_stack.voice_expression(member, type, value);
+                });
+            }
+            return;
+        }
+
+        _voice_stack.for_each_playing([&](size_t voice) {
+            VoiceChannel voice_channel = _voice_stack.get_note_id(voice).channel;
+            if(unison || voice_channel == channel ||
+               (zone != MpeNoZone && _mpe.zone(voice_channel) == zone)) {
+                _voice_stack.voice_expression(voice, type, value);
+            }
+        });
+    }
+
+    void channel_pressure(VoiceExpressionValue value, VoiceChannel channel = 0) {
+        channel_expression(ExpressionPressure, value, channel);
+    }
+
+    /** Channel pitch bend, centered at Constants::PitchBendCenter */
+    void pitch_bend(VoiceExpressionValue value, VoiceChannel channel = 0) {
+        channel_expression(ExpressionPitchBend, value, channel);
+    }
+
+    /**
+     * Keep stopped voices in VoiceReleasing until voice_finished() is called for them.
+     * Allocation then prefers idle voices, then the oldest releasing voice, and steals a held
+     * voice last. Disabled by default: stopped voices are idle at once.
+     */
+    void set_release_tracking(bool enabled) {
+        _voice_stack.set_release_tracking(enabled);
+    }
+
+    /** The synth reports that a releasing voice went silent */
+    void voice_finished(size_t voice) {
+        if(voice < voice_count()) {
+            _voice_stack.voice_finished(voice);
+        }
+    }
+
+    /** State of the voice, VoiceIdle for InvalidVoice */
+    VoiceState voice_state(size_t voice) {
+        if(voice >= voice_count()) {
+            return VoiceIdle;
+        }
+        return _voice_stack.voice_state(voice);
+    }
+
+    /** A note on would get an idle or releasing voice without stealing a held one */
+    bool has_free_voice() {
+        return _voice_stack.has_free();
+    }
+
+    /**
+     * Voices that sound, a set bit per voice that is not VoiceIdle: it plays a note or, with
+     * release tracking, still releases. Only with a fixed VoiceCount, see for_each_active().
+     */
+    BitSet<VoiceCount> active_mask() const {
+        static_assert(
+            VoiceCount != Constants::DynamicVoiceCount, "Use for_each_active() with arenas");
+        return _voice_stack.busy_mask();
+    }
+
+    /** Call fn(voice) for every voice in active_mask(), lowest first */
+    template <class Fn> void for_each_active(Fn fn) const {
+        _voice_stack.for_each_busy(fn);
+    }
+
+    /** Number of voices in active_mask() */
+    size_t active_count() const {
+        return _voice_stack.busy_count();
+    }
+
+    /**
+     * The synth reports the current loudness of a voice, for PolyQuietestVoice.
+     * A started voice assumes its velocity as level until the synth reports one. Levels are
+     * kept with every strategy, the quietest voice is only tracked with PolyQuietestVoice.
+     */
+    void set_voice_level(size_t voice, VoiceLevel level) {
+        if(voice < voice_count()) {
+            _voice_stack.set_level(voice, level);
+        }
+    }
+
+    /** Output buffer size that always fits the voice events of count input events */
+    size_t output_capacity(size_t count) const {
+        return count * voice_count();
+    }
+
+    /**
+     * Handle a block of note events in one call, only with EventBufferSink.
+     * Writes the voice events to out[capacity] in offset order and returns their count,
+     * an input event with an offset below the previous one is treated as simultaneous with it.
+     * Events that do not fit are dropped and counted by sink().dropped().
+     */
+    size_t process(const InputEvent* events, size_t count, OutputEvent* out, size_t capacity) {
+        Sink& sink = _voice_stack.sink();
+        sink.set_buffer(out, capacity);
+
+        for(size_t i = 0; i < count; i++) {
+            if(events[i].offset > sink.offset()) {
+                sink.set_offset(events[i].offset);
+            }
+            handle_event(events[i]);
+        }
+
+        return sink.size();
+    }
+
+    /** Note or controller event from an InputEvent, the offset is left to the caller */
+    void handle_event(const InputEvent& event) {
+        switch(event.type) {
+        case InputEvent::NoteOn:
+            note_on(event.note, event.velocity, event.channel);
+            break;
+        case InputEvent::NoteOff:
+            note_off(event.note, event.channel);
+            break;
+        case InputEvent::ControlChange:
+            control_change(event.note, event.velocity, event.channel);
+            break;
+        case InputEvent::PolyPressure:
+            poly_pressure(event.note, event.velocity, event.channel);
+            break;
+        case InputEvent::ChannelPressure:
+            channel_pressure(event.velocity, event.channel);
+            break;
+        case InputEvent::PitchBend:
+            pitch_bend(event.velocity, event.channel);
+            break;
+        }
+    }
+
+private:
+    class VoiceStack;
+
+    VoiceStack _voice_stack;
+
+    /**
+     * Pedal state. Poly strategies keep the key state of every voice in the voice stack, the
+     * note stack keeps it per note for the unison strategies.
+     */
+    bool _sustain;
+    bool _sostenuto;
+
+    MpeLayout _mpe;
+
+    /** Whether the policy keeps a NoteStack, poly policies without one skip its upkeep */
+    typedef std::integral_constant<
+        bool,
+        !std::is_same<decltype(std::declval<Policy&>().note_stack()), NullNoteStack>::value>
+        HoldsNotes;
 
-        if(strategy_is_unison()) {
-            _note_stack.pop(note);
-        }
+    /** A pedal holds a key that goes up, sostenuto only the keys it caught going down */
+    bool pedal_holds(bool caught_by_sostenuto) const {
+        return _sustain || (_sostenuto && caught_by_sostenuto);
+    }
 
-        switch(_strategy) {
+    /** Voice events of a unison strategy once a note left the note stack */
+    void unison_note_off() {
+        switch(this->strategy()) {
         case UnisonHighestNote:
             unison_highest_note_off();
             break;
@@ -120,50 +1642,87 @@ public:
         case UnisonOldestNote:
             unison_oldest_note_off();
             break;
-        case PolyLeastRecentlyUsed:
-        case PolyMostRecentlyUsed:
-            poly_note_off(note);
+        default:
             break;
         }
     }
 
-private:
-    class NoteStack;
-    class VoiceStack;
+    /**
+     * Poly strategies keep the note stack in step with the voices for the strategy switches:
+     * a note stays held on the channel of a voice that plays it with its key down, else of one
+     * that a pedal holds, and leaves once no voice plays it
+     */
+    void note_stack_sync(VoiceNote note, std::true_type) {
+        size_t voice = _voice_stack.get_holder(note);
+        if(voice == Constants::InvalidVoice) {
+            this->note_stack().pop(note);
+            return;
+        }
 
-    /** The note stack */
-    NoteStack _note_stack;
-    VoiceStack _voice_stack;
+        this->note_stack().set_channel(note, _voice_stack.get_note_id(voice).channel);
+        if(_voice_stack.is_deferred(voice)) {
+            this->note_stack().defer(note);
+        }
+    }
 
-    /** The strategy to use for voice allocation */
-    Strategy _strategy;
+    void note_stack_sync(VoiceNote, std::false_type) {
+    }
 
-    bool strategy_is_unison() {
-        return _strategy == UnisonHighestNote || _strategy == UnisonLowestNote ||
-               _strategy == UnisonNewestNote || _strategy == UnisonOldestNote;
+    /**
+     * Pedal up: release the voices and notes it held in one pass, those the sostenuto pedal
+     * still holds stay
+     */
+    void release_deferred() {
+        if(!is_unison_strategy(this->strategy())) {
+            _voice_stack.for_each_deferred(_sostenuto, [&](size_t voice) {
+                VoiceNote note = _voice_stack.get_note_id(voice).note;
+                _voice_stack.voice_stop(voice);
+                note_stack_sync(note, HoldsNotes());
+            });
+        }
+        release_deferred_notes(HoldsNotes());
     }
 
-    void unison_outputs_start(VoiceNote note) {
-        for(size_t i = 0; i < VoiceCount; i++) {
-            _voice_stack.voice_start(i, note, false);
+    /** Unison voices follow the released notes with one event, poly notes follow the voices */
+    void release_deferred_notes(std::true_type) {
+        BitSet<Constants::MaxNotes> released = this->note_stack().take_deferred(_sostenuto);
+        if(!released.any()) {
+            return;
         }
+
+        const bool unison = is_unison_strategy(this->strategy());
+        released.for_each([&](size_t note) {
+            if(unison) {
+                this->note_stack().pop(note);
+            } else {
+                note_stack_sync(note, HoldsNotes());
+            }
+        });
+        if(unison) {
+            unison_note_off();
+        }
+    }
+
+    void release_deferred_notes(std::false_type) {
+    }
+
+    void unison_outputs_start(VoiceNote note) {
+        _voice_stack.unison_start(
+            note, this->note_stack().velocity(note), this->note_stack().channel(note));
     }
 
     void unison_outputs_continue(VoiceNote note) {
-        for(size_t i = 0; i < VoiceCount; i++) {
-            _voice_stack.voice_continue(i, note, false);
-        }
+        _voice_stack.unison_continue(
+            note, this->note_stack().velocity(note), this->note_stack().channel(note));
     }
 
     void unison_outputs_stop() {
-        for(size_t i = 0; i < VoiceCount; i++) {
-            _voice_stack.voice_stop(i, false);
-        }
+        _voice_stack.unison_stop();
     }
 
     bool get_highest_note(VoiceNote& note) {
-        if(!_note_stack.empty()) {
-            note = _note_stack.get_highest_note();
+        if(!this->note_stack().empty()) {
+            note = this->note_stack().get_highest_note();
             return true;
         }
 
@@ -171,8 +1730,8 @@ private:
     }
 
     bool get_lowest_note(VoiceNote& note) {
-        if(!_note_stack.empty()) {
-            note = _note_stack.get_lowest_note();
+        if(!this->note_stack().empty()) {
+            note = this->note_stack().get_lowest_note();
             return true;
         }
 
@@ -211,223 +1770,885 @@ private:
     }
 
     void unison_newest_note_on() {
-        unison_outputs_start(_note_stack.top());
+        unison_outputs_start(this->note_stack().top());
     }
 
     void unison_newest_note_off() {
-        if(!_note_stack.empty()) {
-            unison_outputs_continue(_note_stack.top());
+        if(!this->note_stack().empty()) {
+            unison_outputs_continue(this->note_stack().top());
         } else {
             unison_outputs_stop();
         }
     }
 
     void unison_oldest_note_on() {
-        unison_outputs_start(_note_stack.bottom());
+        unison_outputs_start(this->note_stack().bottom());
     }
 
     void unison_oldest_note_off() {
-        if(!_note_stack.empty()) {
-            unison_outputs_continue(_note_stack.bottom());
+        if(!this->note_stack().empty()) {
+            unison_outputs_continue(this->note_stack().bottom());
         } else {
             unison_outputs_stop();
         }
     }
 
-    void poly_least_recently_used_note_on(VoiceNote note) {
+    /** Note the unison strategy plays for the held notes, false if none is held */
+    bool unison_note(VoiceNote& note) {
+        if(this->note_stack().empty()) {
+            return false;
+        }
+
+        switch(this->strategy()) {
+        case UnisonHighestNote:
+            note = this->note_stack().get_highest_note();
+            break;
+        case UnisonLowestNote:
+            note = this->note_stack().get_lowest_note();
+            break;
+        case UnisonOldestNote:
+            note = this->note_stack().bottom();
+            break;
+        default:
+            note = this->note_stack().top();
+            break;
+        }
+        return true;
+    }
+
+    /**
+     * Move every voice to the unison note on its channel: start idle voices, continue the
+     * others
+     */
+    void unison_switch() {
+        VoiceNote note;
+        if(!unison_note(note)) {
+            _voice_stack.for_each_playing([this](size_t voice) {
+                _voice_stack.voice_stop(voice, false);
+            });
+            return;
+        }
+
+        VoiceVelocity velocity = this->note_stack().velocity(note);
+        VoiceChannel channel = this->note_stack().channel(note);
+        for(size_t i = 0; i < _voice_stack.voice_count(); i++) {
+            if(_voice_stack.get_note_id(i).note == Constants::InvalidNote) {
+                _voice_stack.voice_start(i, note, velocity, channel, false);
+            } else {
+                _voice_stack.voice_continue(i, note, velocity, false);
+                _voice_stack.voice_set_channel(i, channel);
+            }
+        }
+    }
+
+    /**
+     * Spread the newest held notes over the voices, or over the groups for PolyStacked,
+     * oldest first so that the recency order follows the notes, each on the channel it was
+     * played on. The first group keeps the note voice 0 plays, voices that already play their
+     * note stay silent and the voices left over stop. Unison voices may play the note on
+     * another channel, they only take the note's channel over.
+     */
+    void poly_switch(bool from_unison) {
+        const size_t size = this->strategy() == PolyStacked ? stack_size() : 1;
+        const size_t groups = voice_count() / size;
+        VoiceNote unison = _voice_stack.get_note_id(0).note;
+
+        VoiceNote first = Constants::InvalidNote;
+        bool keep = false;
+        size_t held = 0;
+        for(VoiceNote note = this->note_stack().top();
+            note != Constants::InvalidNote && held < groups;
+            note = this->note_stack().below(note)) {
+            first = note;
+            keep = keep || note == unison;
+            held++;
+        }
+
+        size_t voice = keep ? size : 0;
+        for(VoiceNote note = first; note != Constants::InvalidNote;
+            note = this->note_stack().above(note)) {
+            size_t group = keep && note == unison ? 0 : voice;
+            if(group == voice) {
+                voice += size;
+            }
+
+            VoiceVelocity velocity = this->note_stack().velocity(note);
+            VoiceChannel channel = this->note_stack().channel(note);
+            for(size_t i = group; i < group + size; i++) {
+                if(from_unison && _voice_stack.get_note_id(i).note == note) {
+                    _voice_stack.voice_set_channel(i, channel);
+                } else {
+                    _voice_stack.voice_start(i, note, velocity, channel, false);
+                }
+                _voice_stack.voice_pedal(
+                    i, this->note_stack().deferred(note), this->note_stack().sostenuto(note));
+                _voice_stack.voice_touch(i);
+            }
+        }
+
+        for(; voice < _voice_stack.voice_count(); voice++) {
+            if(_voice_stack.get_note_id(voice).note != Constants::InvalidNote) {
+                _voice_stack.voice_stop(voice);
+            }
+        }
+    }
+
+    void poly_least_recently_used_note_on(
+        VoiceNote note,
+        VoiceVelocity velocity,
+        VoiceChannel channel) {
         size_t voice = _voice_stack.get_free();
         if(voice == Constants::InvalidVoice) {
             voice = _voice_stack.get_least_recently_used();
         }
-        _voice_stack.voice_start(voice, note);
+        _voice_stack.voice_start(voice, note, velocity, channel);
     }
 
-    void poly_most_recently_used_note_on(VoiceNote note) {
+    void poly_most_recently_used_note_on(
+        VoiceNote note,
+        VoiceVelocity velocity,
+        VoiceChannel channel) {
         size_t voice = _voice_stack.get_free();
         if(voice == Constants::InvalidVoice) {
             voice = _voice_stack.get_most_recently_used();
         }
-        _voice_stack.voice_start(voice, note);
+        _voice_stack.voice_start(voice, note, velocity, channel);
     }
 
-    void poly_note_off(VoiceNote note) {
-        size_t voice = _voice_stack.get_by_note(note);
-        if(voice != Constants::InvalidVoice) {
-            _voice_stack.voice_stop(voice);
+    void poly_quietest_voice_note_on(
+        VoiceNote note,
+        VoiceVelocity velocity,
+        VoiceChannel channel) {
+        size_t voice = _voice_stack.get_free();
+        if(voice == Constants::InvalidVoice) {
+            voice = _voice_stack.get_quietest();
+        }
+        _voice_stack.voice_start(voice, note, velocity, channel);
+    }
+
+    void poly_round_robin_note_on(
+        VoiceNote note,
+        VoiceVelocity velocity,
+        VoiceChannel channel) {
+        size_t voice = _voice_stack.get_round_robin();
+        _voice_stack.voice_start(voice, note, velocity, channel, false);
+    }
+
+    static bool stacking_changed(Strategy from, Strategy to) {
+        return from != to && (from == PolyStacked || to == PolyStacked);
+    }
+
+    void poly_stacked_note_on(VoiceNote note, VoiceVelocity velocity, VoiceChannel channel) {
+        const size_t size = stack_size();
+        const size_t used = voice_count() - voice_count() % size;
+
+        // One decision for the whole group: an idle group, else a released one, else the
+        // group of the least recently used voice
+        size_t group = _voice_stack.get_idle_group(size, used);
+        if(group == Constants::InvalidVoice) {
+            group = _voice_stack.get_released_group(size, used);
+        }
+        if(group == Constants::InvalidVoice) {
+            size_t voice = _voice_stack.get_least_recently_used_below(used);
+            group = voice - voice % size;
+        }
+
+        for(size_t i = group; i < group + size; i++) {
+            _voice_stack.voice_start(i, note, velocity, channel);
+        }
+    }
+
+    /** Call fn(voice) for the voice, with PolyStacked for the voices of its group on its note */
+    template <class Fn> void for_each_stacked(size_t voice, Fn fn) {
+        if(this->strategy() != PolyStacked) {
+            fn(voice);
+            return;
+        }
+
+        const size_t size = stack_size();
+        const size_t group = voice - voice % size;
+        NoteId id = _voice_stack.get_note_id(voice);
+        for(size_t i = group; i < group + size && i < voice_count(); i++) {
+            NoteId member = _voice_stack.get_note_id(i);
+            if(member.note == id.note && member.channel == id.channel) {
+                fn(i);
+            }
         }
     }
+
+    void poly_note_off(size_t voice) {
+        bool need_to_touch = this->strategy() != PolyRoundRobin;
+        for_each_stacked(voice, [&](size_t member) {
+            _voice_stack.voice_stop(member, need_to_touch);
+        });
+    }
 };
 
-template <size_t VoiceCount> class VoiceManager<VoiceCount>::NoteStack {
+template <size_t VoiceCount, class Policy, class Sink>
+class VoiceManager<VoiceCount, Policy, Sink>::VoiceStack : public VoiceStorage<VoiceCount> {
 public:
-    NoteStack() {
+    VoiceStack()
+        : _release_tracking(false)
+        , _quietest_tracking(false) {
+        reset();
+    }
+
+    explicit VoiceStack(const Sink& sink)
+        : _release_tracking(false)
+        , _quietest_tracking(false)
+        , _sink(sink) {
         reset();
     }
 
+    Sink& sink() {
+        return _sink;
+    }
+
     void reset() {
-        _top = 0;
-        std::fill_n(_notes, Constants::MaxNotes, Constants::InvalidNote);
+        _round_robin = 0;
+        _release_oldest = NoVoice;
+        _release_newest = NoVoice;
+        _releasing.reset();
+        _deferred.reset();
+        _sostenuto.reset();
+        const size_t count = this->voice_count();
+        VoiceLinks::order(&_newer[0], &_older[0], _most_recent, _least_recent, count);
+        std::fill_n(_notes, count, Constants::InvalidNote);
+        std::fill_n(_note_first, Constants::MaxNotes, NoVoice);
+        std::fill_n(_channel, count, 0);
+        std::fill_n(_channel_voice, Constants::MaxChannels, NoVoice);
+        _free.set_all();
+        std::fill_n(_level, count, 0);
+        if(tracks_quietest()) {
+            rebuild_quietest();
+        }
     }
 
-    void push(VoiceNote note) {
-        _notes[_top] = note;
-        _top++;
-        if(_top >= Constants::MaxNotes) {
-            _top = Constants::MaxNotes - 1;
+    /**
+     * Voice that has been playing the note the longest on the channel, or InvalidVoice.
+     * Walks only the voices that play this note number, one per channel at most in MPE.
+     */
+    size_t get_by_note(VoiceNote note, VoiceChannel channel) {
+        size_t first = _note_first[note];
+        size_t voice = first;
+        while(voice != NoVoice) {
+            if(_channel[voice] == channel) {
+                return voice;
+            }
+            voice = _chain_next[voice];
+            if(voice == first) {
+                break;
+            }
         }
+        return Constants::InvalidVoice;
     }
 
-    void pop(VoiceNote note) {
-        for(size_t i = 0; i < _top; i++) {
-            if(_notes[i] == note) {
-                for(size_t j = i; j < _top - 1; j++) {
-                    _notes[j] = _notes[j + 1];
-                }
-                _top--;
-                return;
+    /**
+     * Oldest voice that plays the note on the channel with its key up under a pedal when
+     * deferred is set, else with its key down, or InvalidVoice
+     */
+    size_t get_by_key(VoiceNote note, VoiceChannel channel, bool deferred) {
+        size_t first = _note_first[note];
+        size_t voice = first;
+        while(voice != NoVoice) {
+            if(_channel[voice] == channel && _deferred.test(voice) == deferred) {
+                return voice;
+            }
+            voice = _chain_next[voice];
+            if(voice == first) {
+                break;
             }
         }
+        return Constants::InvalidVoice;
     }
 
-    VoiceNote top() {
-        return _notes[_top - 1];
+    /** Oldest voice that plays the note with its key down, else the oldest a pedal holds */
+    size_t get_holder(VoiceNote note) {
+        size_t holder = Constants::InvalidVoice;
+        for_each_by_note(note, [&](size_t voice) {
+            if(holder == Constants::InvalidVoice ||
+               (_deferred.test(holder) && !_deferred.test(voice))) {
+                holder = voice;
+            }
+        });
+        return holder;
     }
 
-    VoiceNote bottom() {
-        return _notes[0];
+    size_t get_by_channel(VoiceChannel channel) {
+        return to_voice(_channel_voice[channel]);
     }
 
-    bool empty() {
-        return _top == 0;
+    /** Call fn(voice) for every voice that plays the note, oldest first, fn must keep notes */
+    template <class Fn> void for_each_by_note(VoiceNote note, Fn fn) {
+        size_t first = _note_first[note];
+        size_t voice = first;
+        while(voice != NoVoice) {
+            fn(voice);
+            voice = _chain_next[voice];
+            if(voice == first) {
+                break;
+            }
+        }
     }
 
-    VoiceNote get_highest_note() {
-        VoiceNote highest_note = 0;
-        for(size_t i = 0; i < _top; i++) {
-            if(_notes[i] > highest_note) {
-                highest_note = _notes[i];
+    /** Call fn(voice) for every voice that plays a note */
+    template <class Fn> void for_each_playing(Fn fn) {
+        for(size_t i = 0; i < this->voice_count(); i++) {
+            if(_notes[i] != Constants::InvalidNote) {
+                fn(i);
             }
         }
-        return highest_note;
     }
 
-    VoiceNote get_lowest_note() {
-        VoiceNote lowest_note = Constants::MaxNotes - 1;
-        for(size_t i = 0; i < _top; i++) {
-            if(_notes[i] < lowest_note) {
-                lowest_note = _notes[i];
+    NoteId get_note_id(size_t voice) {
+        NoteId id = {_channel[voice], _notes[voice]};
+        return id;
+    }
+
+    /** Lowest idle voice, else the oldest releasing voice, else InvalidVoice */
+    size_t get_free() {
+        size_t voice = _free.find_first();
+        if(voice != VoiceBits::NotFound) {
+            return voice;
+        }
+        return to_voice(_release_oldest);
+    }
+
+    /**
+     * Idle voice at or after the round robin cursor, wrapping around, else the oldest
+     * releasing voice, else the voice at the cursor. Moves the cursor past the voice.
+     */
+    size_t get_round_robin() {
+        size_t voice = _free.find_next(_round_robin);
+        if(voice == VoiceBits::NotFound) {
+            voice = _free.find_first();
+        }
+        if(voice == VoiceBits::NotFound) {
+            voice = _release_oldest != NoVoice ? _release_oldest : _round_robin;
+        }
+        _round_robin = voice + 1 < this->voice_count() ? voice + 1 : 0;
+        return voice;
+    }
+
+    bool has_free() {
+        return _free.any() || _release_oldest != NoVoice;
+    }
+
+    void set_release_tracking(bool enabled) {
+        _release_tracking = enabled;
+        while(!enabled && _release_oldest != NoVoice) {
+            voice_finished(_release_oldest);
+        }
+    }
+
+    void voice_finished(size_t voice) {
+        if(_releasing.test(voice)) {
+            release_unlink(voice);
+            _free.set(voice);
+        }
+    }
+
+    bool is_deferred(size_t voice) {
+        return _deferred.test(voice);
+    }
+
+    bool is_sostenuto(size_t voice) {
+        return _sostenuto.test(voice);
+    }
+
+    /** The key of the voice went up while a pedal holds it */
+    void voice_defer(size_t voice) {
+        _deferred.set(voice);
+    }
+
+    /** Set the pedal state of a playing voice */
+    void voice_pedal(size_t voice, bool deferred, bool sostenuto) {
+        if(deferred) {
+            _deferred.set(voice);
+        } else {
+            _deferred.clear(voice);
+        }
+        if(sostenuto) {
+            _sostenuto.set(voice);
+        } else {
+            _sostenuto.clear(voice);
+        }
+    }
+
+    /** Sostenuto down: it catches the voices that play with their key down */
+    void capture_sostenuto() {
+        for_each_playing([this](size_t voice) {
+            if(!_deferred.test(voice)) {
+                _sostenuto.set(voice);
+            }
+        });
+    }
+
+    void release_sostenuto() {
+        _sostenuto.reset();
+    }
+
+    /**
+     * Call fn(voice) for every voice a pedal holds, but those sostenuto caught when
+     * skip_sostenuto is set, fn may stop the voice
+     */
+    template <class Fn> void for_each_deferred(bool skip_sostenuto, Fn fn) {
+        for(size_t voice = _deferred.find_first(); voice != VoiceBits::NotFound;
+            voice = _deferred.find_next(voice + 1)) {
+            if(!skip_sostenuto || !_sostenuto.test(voice)) {
+                fn(voice);
             }
         }
-        return lowest_note;
     }
 
-private:
-    VoiceNote _notes[Constants::MaxNotes];
-    size_t _top;
-};
+    /** Voices that are not VoiceIdle */
+    typename VoiceStorage<VoiceCount>::VoiceBits busy_mask() const {
+        VoiceBits mask;
+        mask.set_all();
+        return mask.clear(_free);
+    }
 
-template <size_t VoiceCount> class VoiceManager<VoiceCount>::VoiceStack {
-public:
-    VoiceStack() {
-        std::fill_n(
-            _callbacks, VoiceCount, (VoiceOutputCallbacks){.start = 0, .cont = 0, .stop = 0});
-        std::fill_n(_context, VoiceCount, nullptr);
-        reset();
+    template <class Fn> void for_each_busy(Fn fn) const {
+        _free.for_each_clear(fn);
     }
 
-    void set_output_callbacks(
-        VoiceOutputCallbacks callbacks[VoiceCount],
-        void* context[VoiceCount]) {
-        std::copy(callbacks, callbacks + VoiceCount, _callbacks);
-        std::copy(context, context + VoiceCount, _context);
+    size_t busy_count() const {
+        return this->voice_count() - _free.count();
     }
 
-    void reset() {
-        _round_robin = 0;
-        std::iota(_voice, _voice + VoiceCount, 0);
-        std::fill_n(_notes, VoiceCount, Constants::InvalidNote);
+    VoiceState voice_state(size_t voice) {
+        if(_free.test(voice)) {
+            return VoiceIdle;
+        }
+        return _releasing.test(voice) ? VoiceReleasing : VoiceActive;
+    }
+
+    size_t get_least_recently_used() {
+        return _least_recent;
     }
 
-    size_t get_by_note(VoiceNote note) {
-        for(size_t i = 0; i < VoiceCount; i++) {
-            if(_notes[i] == note) {
-                return i;
+    /** Lowest group of size voices below limit whose voices are all idle, or InvalidVoice */
+    size_t get_idle_group(size_t size, size_t limit) {
+        size_t voice = _free.find_first();
+        while(voice != VoiceBits::NotFound && voice < limit) {
+            size_t group = voice - voice % size;
+            size_t member = group;
+            while(member < group + size && _free.test(member)) {
+                member++;
+            }
+            if(member == group + size) {
+                return group;
             }
+            voice = _free.find_next(group + size);
         }
         return Constants::InvalidVoice;
     }
 
-    size_t get_free() {
-        for(size_t i = 0; i < VoiceCount; i++) {
-            if(_notes[i] == Constants::InvalidNote) {
-                return i;
+    /**
+     * Group of the oldest releasing voice below limit whose voices are all idle or
+     * releasing, or InvalidVoice
+     */
+    size_t get_released_group(size_t size, size_t limit) {
+        for(size_t voice = _release_oldest; voice != NoVoice; voice = _chain_next[voice]) {
+            if(voice >= limit) {
+                continue;
+            }
+            size_t group = voice - voice % size;
+            size_t member = group;
+            while(member < group + size && _notes[member] == Constants::InvalidNote) {
+                member++;
+            }
+            if(member == group + size) {
+                return group;
             }
         }
         return Constants::InvalidVoice;
     }
 
-    size_t get_least_recently_used() {
-        return _voice[VoiceCount - 1];
+    /** Least recently used voice below limit, the voices above it are skipped */
+    size_t get_least_recently_used_below(size_t limit) {
+        size_t voice = _least_recent;
+        while(voice >= limit) {
+            voice = _newer[voice];
+        }
+        return voice;
     }
 
     size_t get_most_recently_used() {
-        return _voice[0];
+        return _most_recent;
     }
 
-    void voice_start(size_t voice, VoiceNote note, bool need_to_touch = true) {
-        if(_notes[voice] != note) {
-            _notes[voice] = note;
-            if(_callbacks[voice].start) {
-                _callbacks[voice].start(_context[voice], note);
-            }
-            if(need_to_touch) touch(voice, note);
+    /** Voice with the lowest level, the lowest index on ties, only while tracked */
+    size_t get_quietest() {
+        return this->voice_count() > 1 ? _quietest[1] : 0;
+    }
+
+    /**
+     * Keep the quietest voice tree up to date, only PolyQuietestVoice needs it. Turning it on
+     * rebuilds the tree from the levels once.
+     */
+    void set_quietest_tracking(bool enabled) {
+        enabled = enabled && Policy::may_use(PolyQuietestVoice);
+        if(enabled && !_quietest_tracking) {
+            _quietest_tracking = true;
+            rebuild_quietest();
+        }
+        _quietest_tracking = enabled;
+    }
+
+    void set_level(size_t voice, VoiceLevel level) {
+        _level[voice] = level;
+        if(!tracks_quietest() || this->voice_count() < 2) {
+            return;
+        }
+
+        // Replay the matches on the way from the voice to the root
+        for(size_t node = (voice + this->voice_count()) / 2; node > 0; node /= 2) {
+            _quietest[node] = quieter(quietest_of(node * 2), quietest_of(node * 2 + 1));
         }
     }
 
-    void voice_continue(size_t voice, VoiceNote note, bool need_to_touch = true) {
+    void voice_start(
+        size_t voice,
+        VoiceNote note,
+        VoiceVelocity velocity,
+        VoiceChannel channel,
+        bool need_to_touch = true) {
+        if(_notes[voice] != note || _channel[voice] != channel) {
+            set_note(voice, note, channel);
+            set_level(voice, velocity);
+            _sink.start(voice, note, velocity);
+            if(need_to_touch) touch(voice);
+        }
+    }
+
+    void voice_continue(
+        size_t voice,
+        VoiceNote note,
+        VoiceVelocity velocity,
+        bool need_to_touch = true) {
         if(_notes[voice] != note) {
-            _notes[voice] = note;
-            if(_callbacks[voice].cont) {
-                _callbacks[voice].cont(_context[voice], note);
-            }
-            if(need_to_touch) touch(voice, note);
+            set_note(voice, note, _channel[voice]);
+            set_level(voice, velocity);
+            _sink.cont(voice, note, velocity);
+            if(need_to_touch) touch(voice);
         }
     }
 
-    void voice_stop(size_t voice, bool need_to_touch = true) {
-        _notes[voice] = Constants::InvalidNote;
-        if(_callbacks[voice].stop) {
-            _callbacks[voice].stop(_context[voice]);
+    /** Strike the note the voice already plays again, its key is down again */
+    void voice_retrigger(size_t voice, VoiceNote note, VoiceVelocity velocity) {
+        _deferred.clear(voice);
+        set_level(voice, velocity);
+        _sink.cont(voice, note, velocity);
+        touch(voice);
+    }
+
+    /**
+     * Unison strategies keep every voice on the same note, so the voices move as one: the
+     * per-voice state is updated in bulk and the sink gets a single broadcast call when it
+     * supports one. The recency order is left alone. The voices take the channel of the note,
+     * a note they already play only moves to the channel without an event.
+     */
+    void unison_start(VoiceNote note, VoiceVelocity velocity, VoiceChannel channel) {
+        if(this->voice_count() == 0) {
+            return;
+        }
+        bool moved = _notes[0] != note;
+        set_note_all(note, channel);
+        if(moved) {
+            set_level_all(velocity);
+            sink_start_all(note, velocity, Broadcasts());
+        }
+    }
+
+    void unison_continue(VoiceNote note, VoiceVelocity velocity, VoiceChannel channel) {
+        if(this->voice_count() == 0) {
+            return;
+        }
+        bool moved = _notes[0] != note;
+        set_note_all(note, channel);
+        if(moved) {
+            set_level_all(velocity);
+            sink_cont_all(note, velocity, Broadcasts());
+        }
+    }
+
+    void unison_stop() {
+        if(this->voice_count() == 0) {
+            return;
         }
-        if(need_to_touch) touch(voice, Constants::InvalidNote);
+        set_note_all(Constants::InvalidNote, _channel[0]);
+        sink_stop_all(Broadcasts());
+    }
+
+    /** Make the voice the most recently used without an event */
+    void voice_touch(size_t voice) {
+        touch(voice);
+    }
+
+    /** Move the note the voice plays to another channel without an event */
+    void voice_set_channel(size_t voice, VoiceChannel channel) {
+        set_note(voice, _notes[voice], channel);
+    }
+
+    /** Expression does not count as a use of the voice for the LRU order */
+    void voice_expression(size_t voice, VoiceExpression type, VoiceExpressionValue value) {
+        _sink.expression(voice, type, value);
+    }
+
+    void voice_stop(size_t voice, bool need_to_touch = true) {
+        set_note(voice, Constants::InvalidNote, _channel[voice]);
+        _sink.stop(voice);
+        if(need_to_touch) touch(voice);
     }
 
 private:
-    /** Array of voice indices */
-    size_t _voice[VoiceCount];
+    typedef VoiceStorage<VoiceCount> Storage;
+    typedef typename Storage::VoiceBits VoiceBits;
+    typedef typename Storage::VoiceIndex VoiceIndex;
+    using Storage::NoVoice;
+    using Storage::_newer;
+    using Storage::_older;
+    using Storage::_notes;
+    using Storage::_channel;
+    using Storage::_chain_prev;
+    using Storage::_chain_next;
+    using Storage::_free;
+    using Storage::_releasing;
+    using Storage::_deferred;
+    using Storage::_sostenuto;
+    using Storage::_level;
+    using Storage::_quietest;
+
+    /** Ends of the recency list, from _most_recent to _least_recent */
+    VoiceIndex _most_recent;
+    VoiceIndex _least_recent;
+
+    /** Next voice PolyRoundRobin tries */
+    VoiceIndex _round_robin;
+
+    /** Releasing voices, oldest first, linked through the _chain_prev/_chain_next slots */
+    VoiceIndex _release_oldest;
+    VoiceIndex _release_newest;
+
+    /**
+     * Note to voice index: every note heads a circular doubly linked chain of the voices
+     * playing it, in start order, so the same note on several voices is released oldest first
+     */
+    VoiceIndex _note_first[Constants::MaxNotes];
+
+    /** Cold from here on: MPE channel owners, settings and the sink */
+    VoiceIndex _channel_voice[Constants::MaxChannels];
+    bool _release_tracking;
+    bool _quietest_tracking;
+
+    /** Receiver of the voice events */
+    Sink _sink;
+
+    void set_note(size_t voice, VoiceNote note, VoiceChannel channel) {
+        VoiceNote old_note = _notes[voice];
+        if(old_note == note && _channel[voice] == channel) {
+            return;
+        }
 
-    /** Round robin index */
-    size_t _round_robin;
+        // A new note starts with its key down
+        _deferred.clear(voice);
+        _sostenuto.clear(voice);
 
-    /** Array of voice notes */
-    VoiceNote _notes[VoiceCount];
+        if(old_note == Constants::InvalidNote) {
+            if(_releasing.test(voice)) {
+                release_unlink(voice);
+            }
+        } else {
+            if(_channel_voice[_channel[voice]] == voice) {
+                _channel_voice[_channel[voice]] = NoVoice;
+            }
 
-    /** Callbacks to output events */
-    VoiceOutputCallbacks _callbacks[VoiceCount];
-    void* _context[VoiceCount];
+            VoiceLinks::ring_remove(
+                _note_first[old_note], &_chain_prev[0], &_chain_next[0], voice);
+        }
+
+        if(note == Constants::InvalidNote) {
+            if(_release_tracking) {
+                release_link(voice);
+            } else {
+                _free.set(voice);
+            }
+        } else {
+            _free.clear(voice);
+            _channel[voice] = channel;
+            _channel_voice[channel] = voice;
+            VoiceLinks::ring_insert(_note_first[note], &_chain_prev[0], &_chain_next[0], voice);
+        }
+
+        _notes[voice] = note;
+    }
+
+    size_t quietest_of(size_t node) {
+        return node >= this->voice_count() ? node - this->voice_count() : _quietest[node];
+    }
+
+    size_t quieter(size_t a, size_t b) {
+        if(_level[a] != _level[b]) {
+            return _level[a] < _level[b] ? a : b;
+        }
+        return a < b ? a : b;
+    }
+
+    void release_link(size_t voice) {
+        _releasing.set(voice);
+        _chain_prev[voice] = _release_newest;
+        _chain_next[voice] = NoVoice;
+        if(_release_newest != NoVoice) {
+            _chain_next[_release_newest] = voice;
+        } else {
+            _release_oldest = voice;
+        }
+        _release_newest = voice;
+    }
+
+    void release_unlink(size_t voice) {
+        _releasing.clear(voice);
+        size_t prev = _chain_prev[voice];
+        size_t next = _chain_next[voice];
+        if(prev != NoVoice) {
+            _chain_next[prev] = next;
+        } else {
+            _release_oldest = next;
+        }
+        if(next != NoVoice) {
+            _chain_prev[next] = prev;
+        } else {
+            _release_newest = prev;
+        }
+    }
 
-    void touch(size_t voice_index, VoiceNote note) {
-        // Move voice to the start of the stack
-        int32_t source = VoiceCount - 1;
-        int32_t destination = VoiceCount - 1;
-        while(source >= 0) {
-            if(_voice[source] != voice_index) {
-                _voice[destination--] = _voice[source];
+    typedef std::integral_constant<bool, SinkBroadcasts<Sink>::value> Broadcasts;
+
+    /**
+     * set_note() for every voice at once, all voices must play the same note on the same
+     * channel. A ring over all voices moves between notes as a whole, so only starting from
+     * silence walks them.
+     */
+    void set_note_all(VoiceNote note, VoiceChannel channel) {
+        const size_t count = this->voice_count();
+        VoiceNote old_note = _notes[0];
+        if(old_note == note && (note == Constants::InvalidNote || _channel[0] == channel)) {
+            return;
+        }
+
+        // Unison keeps the pedal state on the note stack
+        _deferred.reset();
+        _sostenuto.reset();
+
+        if(old_note != Constants::InvalidNote) {
+            VoiceIndex first = _note_first[old_note];
+            _note_first[old_note] = NoVoice;
+            std::fill_n(_channel_voice, Constants::MaxChannels, (VoiceIndex)NoVoice);
+            if(note != Constants::InvalidNote) {
+                _note_first[note] = first;
+            } else {
+                if(_release_tracking) {
+                    for(size_t i = 0; i < count; i++) {
+                        release_link(i);
+                    }
+                } else {
+                    _free.set_all();
+                }
+            }
+        } else {
+            // From silence: every voice leaves the free set and the release list
+            _free.reset();
+            _releasing.reset();
+            _release_oldest = NoVoice;
+            _release_newest = NoVoice;
+            for(size_t i = 0; i < count; i++) {
+                _chain_prev[i] = i > 0 ? i - 1 : count - 1;
+                _chain_next[i] = i + 1 < count ? i + 1 : 0;
             }
-            --source;
+            _note_first[note] = 0;
+        }
+
+        if(note != Constants::InvalidNote) {
+            std::fill_n(_channel, count, channel);
+            _channel_voice[channel] = count - 1;
+        }
+        std::fill_n(_notes, count, note);
+    }
+
+    /** Equal levels: the quietest voice of every subtree is its lowest one */
+    void set_level_all(VoiceLevel level) {
+        std::fill_n(_level, this->voice_count(), level);
+        if(tracks_quietest()) {
+            rebuild_quietest();
+        }
+    }
+
+    /** Folds to false for policies that never use PolyQuietestVoice */
+    bool tracks_quietest() const {
+        return Policy::may_use(PolyQuietestVoice) && _quietest_tracking;
+    }
+
+    void rebuild_quietest() {
+        for(size_t node = this->voice_count(); node > 1; node--) {
+            _quietest[node - 1] =
+                quieter(quietest_of((node - 1) * 2), quietest_of((node - 1) * 2 + 1));
+        }
+    }
+
+    void sink_start_all(VoiceNote note, VoiceVelocity velocity, std::true_type) {
+        _sink.start_all(note, velocity);
+    }
+
+    void sink_start_all(VoiceNote note, VoiceVelocity velocity, std::false_type) {
+        for(size_t i = 0; i < this->voice_count(); i++) {
+            _sink.start(i, note, velocity);
+        }
+    }
+
+    void sink_cont_all(VoiceNote note, VoiceVelocity velocity, std::true_type) {
+        _sink.cont_all(note, velocity);
+    }
+
+    void sink_cont_all(VoiceNote note, VoiceVelocity velocity, std::false_type) {
+        for(size_t i = 0; i < this->voice_count(); i++) {
+            _sink.cont(i, note, velocity);
+        }
+    }
+
+    void sink_stop_all(std::true_type) {
+        _sink.stop_all();
+    }
+
+    void sink_stop_all(std::false_type) {
+        for(size_t i = 0; i < this->voice_count(); i++) {
+            _sink.stop(i);
+        }
+    }
+
+    static size_t to_voice(size_t index) {
+        return index == NoVoice ? Constants::InvalidVoice : index;
+    }
+
+    void touch(size_t voice) {
+        // A single voice is always the most recent
+        if(this->voice_count() > 1) {
+            VoiceLinks::touch(&_newer[0], &_older[0], _most_recent, _least_recent, voice);
         }
-        _voice[0] = voice_index;
-        _notes[voice_index] = note;
     }
 };
+
+/**
+ * Footprint budgets for reference configurations, so that a change cannot grow the state
+ * by accident. Raise them only on purpose.
+ */
+static_assert(sizeof(NoteStack) <= 5 * Constants::MaxNotes + 56, "NoteStack footprint");
+static_assert(sizeof(VoiceStorage<8>) <= 8 * 9 + 4 * 8, "VoiceStorage footprint, 8 voices");
+static_assert(sizeof(VoiceStorage<64>) <= 64 * 9 + 4 * 8, "VoiceStorage footprint, 64 voices");
+static_assert(
+    sizeof(VoiceStorage<256>) <= 256 * 14 + 4 * 32,
+    "VoiceStorage footprint, 256 voices");
+static_assert(
+    sizeof(VoiceManager<8, FixedStrategy<PolyLeastRecentlyUsed>, EventBufferSink>) <= 352,
+    "Poly VoiceManager footprint, 8 voices");
 }
\ No newline at end of file
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace VoiceAllocator {
+
+namespace Bits {
+
+/** Index of the lowest set bit, value must not be 0 */
+inline size_t find_first(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    size_t index = 0;
+    if((value & 0xFFFFFFFFull) == 0) {
+        value >>= 32;
+        index += 32;
+    }
+    if((value & 0xFFFFull) == 0) {
+        value >>= 16;
+        index += 16;
+    }
+    if((value & 0xFFull) == 0) {
+        value >>= 8;
+        index += 8;
+    }
+    if((value & 0xFull) == 0) {
+        value >>= 4;
+        index += 4;
+    }
+    if((value & 0x3ull) == 0) {
+        value >>= 2;
+        index += 2;
+    }
+    if((value & 0x1ull) == 0) {
+        index += 1;
+    }
+    return index;
+#endif
+}
+
+/** Index of the highest set bit, value must not be 0 */
+inline size_t find_last(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    size_t index = 0;
+    if(value & 0xFFFFFFFF00000000ull) {
+        value >>= 32;
+        index += 32;
+    }
+    if(value & 0xFFFF0000ull) {
+        value >>= 16;
+        index += 16;
+    }
+    if(value & 0xFF00ull) {
+        value >>= 8;
+        index += 8;
+    }
+    if(value & 0xF0ull) {
+        value >>= 4;
+        index += 4;
+    }
+    if(value & 0xCull) {
+        value >>= 2;
+        index += 2;
+    }
+    if(value & 0x2ull) {
+        index += 1;
+    }
+    return index;
+#endif
+}
+
+/** Number of set bits */
+inline size_t count(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(value);
+#else
+    value = value - ((value >> 1) & 0x5555555555555555ull);
+    value = (value & 0x3333333333333333ull) + ((value >> 2) & 0x3333333333333333ull);
+    value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (value * 0x0101010101010101ull) >> 56;
+#endif
+}
+
+const size_t NotFound = SIZE_MAX;
+
+/**
+ * Number of words needed for size bits. The set functions below work on size bits in
+ * words[word_count(size)] for BitSet and BitSpan, the bits at and above size stay clear.
+ */
+inline size_t word_count(size_t size) {
+    return (size + 63) / 64;
+}
+
+/** Mask of the bits of the last word that are below size */
+inline uint64_t last_word_mask(size_t size) {
+    return size % 64 ? ((uint64_t)1 << (size % 64)) - 1 : ~(uint64_t)0;
+}
+
+inline void reset(uint64_t* words, size_t size) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        words[i] = 0;
+    }
+}
+
+inline void set_all(uint64_t* words, size_t size) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        words[i] = ~(uint64_t)0;
+    }
+    if(size % 64) {
+        words[word_count(size) - 1] = last_word_mask(size);
+    }
+}
+
+inline void set(uint64_t* words, size_t bit) {
+    words[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+inline void clear(uint64_t* words, size_t bit) {
+    words[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+inline bool test(const uint64_t* words, size_t bit) {
+    return (words[bit / 64] >> (bit % 64)) & 1;
+}
+
+inline bool any(const uint64_t* words, size_t size) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        if(words[i]) return true;
+    }
+    return false;
+}
+
+/** Keep only the bits that are also set in other */
+inline void intersect(uint64_t* words, const uint64_t* other, size_t size) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        words[i] &= other[i];
+    }
+}
+
+/** Add the bits that are set in other */
+inline void unite(uint64_t* words, const uint64_t* other, size_t size) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        words[i] |= other[i];
+    }
+}
+
+/** Clear every bit that is set in other */
+inline void subtract(uint64_t* words, const uint64_t* other, size_t size) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        words[i] &= ~other[i];
+    }
+}
+
+/** Call fn(bit) for every set bit, lowest first */
+template <class Fn> void for_each(const uint64_t* words, size_t size, Fn fn) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        uint64_t word = words[i];
+        while(word) {
+            fn(i * 64 + find_first(word));
+            word &= word - 1;
+        }
+    }
+}
+
+/** Call fn(bit) for every clear bit below size, lowest first */
+template <class Fn> void for_each_clear(const uint64_t* words, size_t size, Fn fn) {
+    const size_t count = word_count(size);
+    for(size_t i = 0; i < count; i++) {
+        uint64_t word = ~words[i];
+        if(i == count - 1) {
+            word &= last_word_mask(size);
+        }
+        while(word) {
+            fn(i * 64 + find_first(word));
+            word &= word - 1;
+        }
+    }
+}
+
+/** Number of set bits */
+inline size_t count(const uint64_t* words, size_t size) {
+    size_t bits = 0;
+    for(size_t i = 0; i < word_count(size); i++) {
+        bits += count(words[i]);
+    }
+    return bits;
+}
+
+/** Lowest set bit or NotFound */
+inline size_t find_first(const uint64_t* words, size_t size) {
+    for(size_t i = 0; i < word_count(size); i++) {
+        if(words[i]) return i * 64 + find_first(words[i]);
+    }
+    return NotFound;
+}
+
+/** Lowest set bit at or above from, or NotFound */
+inline size_t find_next(const uint64_t* words, size_t size, size_t from) {
+    if(from >= size) {
+        return NotFound;
+    }
+    size_t i = from / 64;
+    uint64_t word = words[i] & (~(uint64_t)0 << (from % 64));
+    while(!word) {
+        if(++i >= word_count(size)) {
+            return NotFound;
+        }
+        word = words[i];
+    }
+    return i * 64 + find_first(word);
+}
+
+/** Highest set bit or NotFound */
+inline size_t find_last(const uint64_t* words, size_t size) {
+    for(size_t i = word_count(size); i > 0; i--) {
+        if(words[i - 1]) return (i - 1) * 64 + find_last(words[i - 1]);
+    }
+    return NotFound;
+}
+
+}
+
+/** Fixed size set of bits with constant time first/last lookup */
+template <size_t Size> class BitSet {
+public:
+    static const size_t NotFound = Bits::NotFound;
+
+    BitSet() {
+        reset();
+    }
+
+    void reset() {
+        Bits::reset(_words, Size);
+    }
+
+    void set_all() {
+        Bits::set_all(_words, Size);
+    }
+
+    void set(size_t bit) {
+        Bits::set(_words, bit);
+    }
+
+    void clear(size_t bit) {
+        Bits::clear(_words, bit);
+    }
+
+    bool test(size_t bit) const {
+        return Bits::test(_words, bit);
+    }
+
+    bool any() const {
+        return Bits::any(_words, Size);
+    }
+
+    BitSet& operator&=(const BitSet& other) {
+        Bits::intersect(_words, other._words, Size);
+        return *this;
+    }
+
+    BitSet& operator|=(const BitSet& other) {
+        Bits::unite(_words, other._words, Size);
+        return *this;
+    }
+
+    /** Clear every bit that is set in other */
+    BitSet& clear(const BitSet& other) {
+        Bits::subtract(_words, other._words, Size);
+        return *this;
+    }
+
+    /** Call fn(bit) for every set bit, lowest first */
+    template <class Fn> void for_each(Fn fn) const {
+        Bits::for_each(_words, Size, fn);
+    }
+
+    /** Call fn(bit) for every clear bit below Size, lowest first */
+    template <class Fn> void for_each_clear(Fn fn) const {
+        Bits::for_each_clear(_words, Size, fn);
+    }
+
+    /** Number of set bits */
+    size_t count() const {
+        return Bits::count(_words, Size);
+    }
+
+    /** Lowest set bit or NotFound */
+    size_t find_first() const {
+        return Bits::find_first(_words, Size);
+    }
+
+    /** Lowest set bit at or above from, or NotFound */
+    size_t find_next(size_t from) const {
+        return Bits::find_next(_words, Size, from);
+    }
+
+    /** Highest set bit or NotFound */
+    size_t find_last() const {
+        return Bits::find_last(_words, Size);
+    }
+
+private:
+    uint64_t _words[(Size + 63) / 64];
+};
+
+/** Set of bits over caller supplied words, for sizes known only at run time */
+class BitSpan {
+public:
+    static const size_t NotFound = Bits::NotFound;
+
+    BitSpan()
+        : _words(nullptr)
+        , _size(0) {
+    }
+
+    /** Number of words needed for size bits */
+    static size_t word_count(size_t size) {
+        return Bits::word_count(size);
+    }
+
+    /** Use words[word_count(size)], the bits are left as they are */
+    void bind(uint64_t* words, size_t size) {
+        _words = words;
+        _size = size;
+    }
+
+    void reset() {
+        Bits::reset(_words, _size);
+    }
+
+    void set_all() {
+        Bits::set_all(_words, _size);
+    }
+
+    void set(size_t bit) {
+        Bits::set(_words, bit);
+    }
+
+    void clear(size_t bit) {
+        Bits::clear(_words, bit);
+    }
+
+    bool test(size_t bit) const {
+        return Bits::test(_words, bit);
+    }
+
+    bool any() const {
+        return Bits::any(_words, _size);
+    }
+
+    /** Call fn(bit) for every set bit, lowest first */
+    template <class Fn> void for_each(Fn fn) const {
+        Bits::for_each(_words, _size, fn);
+    }
+
+    /** Call fn(bit) for every clear bit below the size, lowest first */
+    template <class Fn> void for_each_clear(Fn fn) const {
+        Bits::for_each_clear(_words, _size, fn);
+    }
+
+    /** Number of set bits */
+    size_t count() const {
+        return Bits::count(_words, _size);
+    }
+
+    /** Lowest set bit or NotFound */
+    size_t find_first() const {
+        return Bits::find_first(_words, _size);
+    }
+
+    /** Lowest set bit at or above from, or NotFound */
+    size_t find_next(size_t from) const {
+        return Bits::find_next(_words, _size, from);
+    }
+
+    /** Highest set bit or NotFound */
+    size_t find_last() const {
+        return Bits::find_last(_words, _size);
+    }
+
+private:
+    uint64_t* _words;
+    size_t _size;
+};
+
+}
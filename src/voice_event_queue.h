@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include "voice_allocator.h"
+
+namespace VoiceAllocator {
+
+/**
+ * Wait-free single producer, single consumer ring buffer.
+ * One thread may push and one other thread may pop, Capacity must be a power of two.
+ * The queue is cache line aligned, keep it in static storage or a member rather than
+ * allocating it with new before C++17.
+ */
+template <class T, size_t Capacity> class SpscQueue {
+    static_assert(
+        Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+        "Capacity must be a power of two");
+
+public:
+    SpscQueue()
+        : _head(0)
+        , _cached_tail(0)
+        , _tail(0)
+        , _cached_head(0)
+        , _overflows(0) {
+    }
+
+    /** Producer: append an item, returns false and counts an overflow when the queue is full */
+    bool push(const T& item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if(tail - _cached_head == Capacity) {
+            _cached_head = _head.load(std::memory_order_acquire);
+            if(tail - _cached_head == Capacity) {
+                _overflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+
+        _items[tail & (Capacity - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer: take the oldest item, returns false when the queue is empty */
+    bool pop(T& item) {
+        return pop(&item, 1) == 1;
+    }
+
+    /** Consumer: take up to count oldest items, returns the number taken */
+    size_t pop(T* items, size_t count) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if(_cached_tail - head < count) {
+            _cached_tail = _tail.load(std::memory_order_acquire);
+        }
+
+        size_t available = _cached_tail - head;
+        if(count > available) {
+            count = available;
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            items[i] = _items[(head + i) & (Capacity - 1)];
+        }
+
+        _head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    /** Consumer: true if there is nothing to pop */
+    bool empty() const {
+        return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+    }
+
+    /** Number of pushes rejected because the queue was full */
+    size_t overflows() const {
+        return _overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Consumer owned line
+    alignas(Constants::CacheLineSize) std::atomic<size_t> _head;
+    size_t _cached_tail;
+
+    // Producer owned line
+    alignas(Constants::CacheLineSize) std::atomic<size_t> _tail;
+    size_t _cached_head;
+    std::atomic<size_t> _overflows;
+
+    alignas(Constants::CacheLineSize) T _items[Capacity];
+};
+
+/** Note event queue from the MIDI/IO thread to the audio thread */
+template <size_t Capacity> using VoiceEventQueue = SpscQueue<InputEvent, Capacity>;
+
+/**
+ * Consumer: feed the queued events to the voice manager, call at the top of each audio block.
+ * Handles at most Capacity events so the call stays bounded while the producer keeps pushing.
+ * Returns the number of events handled.
+ */
+template <size_t Capacity, class Manager>
+size_t drain(VoiceEventQueue<Capacity>& queue, Manager& manager) {
+    const size_t block = 32;
+    InputEvent events[block];
+    size_t handled = 0;
+
+    size_t count;
+    while(handled < Capacity &&
+          (count = queue.pop(events, std::min(block, Capacity - handled))) > 0) {
+        for(size_t i = 0; i < count; i++) {
+            manager.handle_event(events[i]);
+        }
+        handled += count;
+    }
+
+    return handled;
+}
+
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <type_traits>
+#include "voice_allocator.h"
+
+namespace VoiceAllocator {
+
+/**
+ * Many independent VoiceManagers with EventBufferSink in one caller supplied block, for
+ * offline renderers that run thousands of instances. Each instance sits in its own run of
+ * cache lines and keeps no callback pointers, so process() can run disjoint instance ranges
+ * on different threads without false sharing. Use split() to get the ranges: it keeps their
+ * boundaries on whole cache lines of the per-instance output counts as well.
+ *
+ * The events of all instances are passed as one array, the events of instance i are
+ * events[event_starts[i], event_starts[i + 1]). Its voice events go to
+ * out[i * out_stride, i * out_stride + out_stride) and their count to out_counts[i]. With out on
+ * a cache line boundary and an even out_stride, the ranges of split() do not share its lines
+ * either. out_counts has to start on a cache line boundary as well, split() only keeps the
+ * ranges off each other's lines of it then.
+ */
+template <size_t VoiceCount, class Policy = DynamicStrategy> class VoiceManagerBank {
+public:
+    typedef VoiceManager<VoiceCount, Policy, EventBufferSink> Manager;
+
+    static_assert(VoiceCount != Constants::DynamicVoiceCount, "Bank instances are fixed size");
+    static_assert(std::is_trivially_destructible<Manager>::value, "Instances are never destroyed");
+
+    /** Instances per range boundary of split() */
+    static const size_t RangeInstances = Constants::CacheLineSize / sizeof(size_t);
+
+    VoiceManagerBank()
+        : _slots(nullptr)
+        , _instance_count(0) {
+    }
+
+    /** Bytes that bind() needs for instances */
+    static size_t required_bytes(size_t instances) {
+        return instances * sizeof(Slot);
+    }
+
+    /**
+     * Construct instances managers in memory[bytes], aligned to Constants::CacheLineSize.
+     * The memory must outlive the bank. Returns false and keeps the old instances if the
+     * memory is too small or misaligned.
+     */
+    bool bind(void* memory, size_t bytes, size_t instances) {
+        if(bytes < required_bytes(instances) || (uintptr_t)memory % Constants::CacheLineSize) {
+            return false;
+        }
+
+        _slots = (Slot*)memory;
+        _instance_count = instances;
+        for(size_t i = 0; i < instances; i++) {
+            new(&_slots[i]) Slot();
+        }
+        return true;
+    }
+
+    size_t instance_count() const {
+        return _instance_count;
+    }
+
+    /** Instance i, e.g. to set its strategy before the first process() */
+    Manager& instance(size_t i) {
+        return _slots[i].manager;
+    }
+
+    /** Range [first, last) of worker out of workers, ranges start on RangeInstances */
+    void split(size_t worker, size_t workers, size_t& first, size_t& last) const {
+        size_t lines = (_instance_count + RangeInstances - 1) / RangeInstances;
+        first = std::min(lines * worker / workers * RangeInstances, _instance_count);
+        last = std::min(lines * (worker + 1) / workers * RangeInstances, _instance_count);
+    }
+
+    /**
+     * Run VoiceManager::process() for the instances [first, last), see the class comment
+     * for the layout. Returns the number of voice events written by the range.
+     */
+    size_t process(
+        size_t first,
+        size_t last,
+        const InputEvent* events,
+        const size_t* event_starts,
+        OutputEvent* out,
+        size_t out_stride,
+        size_t* out_counts) {
+        size_t total = 0;
+        for(size_t i = first; i < last; i++) {
+            size_t start = event_starts[i];
+            out_counts[i] = _slots[i].manager.process(
+                events + start, event_starts[i + 1] - start, out + i * out_stride, out_stride);
+            total += out_counts[i];
+        }
+        return total;
+    }
+
+private:
+    struct alignas(Constants::CacheLineSize) Slot {
+        Manager manager;
+    };
+
+    Slot* _slots;
+    size_t _instance_count;
+};
+
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "voice_allocator.h"
+
+namespace VoiceAllocator {
+
+namespace Constants {
+const uint8_t NoPart = UINT8_MAX;
+
+/** PartZone::channels value that listens on every channel */
+const uint16_t AllChannels = 0xFFFF;
+}
+
+/** Where a part of a VoicePool listens and how many voices it may use */
+struct PartZone {
+    /** Lowest and highest note of the key range, inclusive */
+    VoiceNote low;
+    VoiceNote high;
+
+    /** One bit per MIDI channel */
+    uint16_t channels;
+
+    /** Voices kept for the part, no other part can steal them */
+    uint16_t min_voices;
+
+    /** Most voices the part may hold, above it the part steals from itself */
+    uint16_t max_voices;
+
+    /** Parts steal from parts with the same or a lower priority */
+    uint8_t priority;
+};
+
+/**
+ * One set of voices shared by PartCount parts, e.g. a bass split, a pad layer and a lead.
+ * A note goes to every part whose zone holds it, so zones may split the keyboard or layer
+ * on it. Each part takes free voices as long as the other parts keep their min_voices, and
+ * once the pool is full it steals the least recently used voice of the part with the
+ * lowest priority that is above its reservation. A part below its own reservation may
+ * steal from any part above theirs. Voices are free again as soon as they stop.
+ *
+ * The sink receives start() and stop() with pool voice indices, part_of() tells the part.
+ */
+template <size_t VoiceCount, size_t PartCount, class Sink = CallbackSink<VoiceCount>>
+class VoicePool {
+    static_assert(VoiceCount > 0, "The pool needs a voice");
+    static_assert(VoiceCount <= UINT16_MAX, "Too many voices");
+    static_assert(PartCount > 0 && PartCount < Constants::NoPart, "Too many parts");
+
+public:
+    VoicePool() {
+        reset_zones();
+        reset();
+    }
+
+    explicit VoicePool(const Sink& sink)
+        : _sink(sink) {
+        reset_zones();
+        reset();
+    }
+
+    /** Free every voice without output, zones are kept */
+    void reset() {
+        _free.set_all();
+        _free_count = VoiceCount;
+        for(size_t part = 0; part < PartCount; part++) {
+            _count[part] = 0;
+            for(size_t note = 0; note < Constants::MaxNotes; note++) {
+                _note_first[part][note] = NoVoice;
+            }
+        }
+
+        for(size_t voice = 0; voice < VoiceCount; voice++) {
+            _notes[voice] = {0, Constants::InvalidNote};
+            _part[voice] = Constants::NoPart;
+        }
+        VoiceLinks::order(&_newer[0], &_older[0], _most_recent, _least_recent, VoiceCount);
+    }
+
+    /** Every part spans all notes and channels with no reservation, no limit, same priority */
+    void reset_zones() {
+        for(size_t part = 0; part < PartCount; part++) {
+            _zones[part] = {0, Constants::MaxNotes - 1, Constants::AllChannels, 0, VoiceCount, 0};
+        }
+    }
+
+    void set_zone(size_t part, const PartZone& zone) {
+        _zones[part] = zone;
+    }
+
+    const PartZone& zone(size_t part) const {
+        return _zones[part];
+    }
+
+    Sink& sink() {
+        return _sink;
+    }
+
+    static constexpr size_t voice_count() {
+        return VoiceCount;
+    }
+
+    static constexpr size_t part_count() {
+        return PartCount;
+    }
+
+    /** Note on for every part whose zone holds the note */
+    void note_on(
+        VoiceNote note,
+        VoiceVelocity velocity = Constants::DefaultVelocity,
+        VoiceChannel channel = 0) {
+        if(note >= Constants::MaxNotes) {
+            note = Constants::MaxNotes - 1;
+        }
+        channel &= Constants::MaxChannels - 1;
+        for(size_t part = 0; part < PartCount; part++) {
+            if(in_zone(part, note, channel)) {
+                part_note_on(part, note, velocity, channel);
+            }
+        }
+    }
+
+    /** Note off for every part whose zone holds the note */
+    void note_off(VoiceNote note, VoiceChannel channel = 0) {
+        if(note >= Constants::MaxNotes) {
+            note = Constants::MaxNotes - 1;
+        }
+        channel &= Constants::MaxChannels - 1;
+        for(size_t part = 0; part < PartCount; part++) {
+            if(in_zone(part, note, channel)) {
+                part_note_off(part, note, channel);
+            }
+        }
+    }
+
+    /**
+     * Note on for one part, the zone is not checked. Returns the voice or
+     * Constants::InvalidVoice when every voice the part may take is reserved.
+     */
+    size_t part_note_on(
+        size_t part,
+        VoiceNote note,
+        VoiceVelocity velocity = Constants::DefaultVelocity,
+        VoiceChannel channel = 0) {
+        if(note >= Constants::MaxNotes) {
+            note = Constants::MaxNotes - 1;
+        }
+        channel &= Constants::MaxChannels - 1;
+        size_t voice = allocate(part);
+        if(voice == Constants::InvalidVoice) {
+            return voice;
+        }
+
+        if(_part[voice] != Constants::NoPart) {
+            unlink(voice);
+        } else {
+            _free.clear(voice);
+            _free_count--;
+        }
+        _part[voice] = part;
+        _count[part]++;
+        _notes[voice] = {channel, note};
+        VoiceLinks::ring_insert(_note_first[part][note], &_chain_prev[0], &_chain_next[0], voice);
+        touch(voice);
+        _sink.start(voice, note, velocity);
+        return voice;
+    }
+
+    /** Note off for one part, stops its oldest voice on the note */
+    void part_note_off(size_t part, VoiceNote note, VoiceChannel channel = 0) {
+        if(note >= Constants::MaxNotes) {
+            note = Constants::MaxNotes - 1;
+        }
+        channel &= Constants::MaxChannels - 1;
+        const size_t first = _note_first[part][note];
+        if(first == NoVoice) {
+            return;
+        }
+
+        // The ring of the note keeps start order, so the first match is the oldest
+        size_t voice = first;
+        do {
+            if(_notes[voice].channel == channel) {
+                voice_stop(voice);
+                return;
+            }
+            voice = _chain_next[voice];
+        } while(voice != first);
+    }
+
+    /** Stop every voice of a part */
+    void part_stop_all(size_t part) {
+        for(size_t voice = 0; voice < VoiceCount; voice++) {
+            if(_part[voice] == part) {
+                voice_stop(voice);
+            }
+        }
+    }
+
+    /** Voices the part holds */
+    size_t part_voices(size_t part) const {
+        return _count[part];
+    }
+
+    /** Part the voice plays for, or Constants::NoPart when it is free */
+    size_t part_of(size_t voice) const {
+        return _part[voice];
+    }
+
+    NoteId voice_note(size_t voice) const {
+        return _notes[voice];
+    }
+
+private:
+    typedef BitSet<VoiceCount> VoiceBits;
+    typedef typename VoiceIndexType<VoiceCount>::Type VoiceIndex;
+    enum : VoiceIndex { NoVoice = (VoiceIndex)~0 };
+
+    bool in_zone(size_t part, VoiceNote note, VoiceChannel channel) const {
+        const PartZone& zone = _zones[part];
+        return note >= zone.low && note <= zone.high &&
+               ((zone.channels >> channel) & 1);
+    }
+
+    /** Free voices the parts other than part still need for their reservations */
+    size_t reserved_for_others(size_t part) const {
+        size_t reserved = 0;
+        for(size_t other = 0; other < PartCount; other++) {
+            if(other != part && _count[other] < _zones[other].min_voices) {
+                reserved += _zones[other].min_voices - _count[other];
+            }
+        }
+        return reserved;
+    }
+
+    size_t allocate(size_t part) {
+        const PartZone& zone = _zones[part];
+        if(_count[part] >= zone.max_voices) {
+            return steal_own(part);
+        }
+
+        if(_free_count > reserved_for_others(part)) {
+            return _free.find_first();
+        }
+
+        // The least recently used voice of the lowest priority part that can spare one, the
+        // part itself always can
+        size_t best = Constants::InvalidVoice;
+        const bool below_min = _count[part] < zone.min_voices;
+        for(size_t candidate = _least_recent; candidate != NoVoice;
+            candidate = _newer[candidate]) {
+            size_t owner = _part[candidate];
+            if(owner == Constants::NoPart) {
+                continue;
+            }
+            if(owner != part) {
+                if(_count[owner] <= _zones[owner].min_voices) {
+                    continue;
+                }
+                if(!below_min && _zones[owner].priority > zone.priority) {
+                    continue;
+                }
+            }
+            if(best == Constants::InvalidVoice ||
+               _zones[owner].priority < _zones[_part[best]].priority) {
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    size_t steal_own(size_t part) {
+        for(size_t voice = _least_recent; voice != NoVoice; voice = _newer[voice]) {
+            if(_part[voice] == part) {
+                return voice;
+            }
+        }
+        return Constants::InvalidVoice;
+    }
+
+    /** Take voice out of the count and the note ring of its part */
+    void unlink(size_t voice) {
+        const size_t part = _part[voice];
+        _count[part]--;
+        VoiceLinks::ring_remove(
+            _note_first[part][_notes[voice].note], &_chain_prev[0], &_chain_next[0], voice);
+    }
+
+    void voice_stop(size_t voice) {
+        unlink(voice);
+        _part[voice] = Constants::NoPart;
+        _notes[voice].note = Constants::InvalidNote;
+        _free.set(voice);
+        _free_count++;
+        touch(voice);
+        _sink.stop(voice);
+    }
+
+    void touch(size_t voice) {
+        VoiceLinks::touch(&_newer[0], &_older[0], _most_recent, _least_recent, voice);
+    }
+
+    VoiceBits _free;
+    size_t _free_count;
+    NoteId _notes[VoiceCount];
+    uint8_t _part[VoiceCount];
+    VoiceIndex _newer[VoiceCount];
+    VoiceIndex _older[VoiceCount];
+    VoiceIndex _chain_prev[VoiceCount];
+    VoiceIndex _chain_next[VoiceCount];
+    VoiceIndex _note_first[PartCount][Constants::MaxNotes];
+    VoiceIndex _most_recent;
+    VoiceIndex _least_recent;
+    uint16_t _count[PartCount];
+    PartZone _zones[PartCount];
+    Sink _sink;
+};
+
+}
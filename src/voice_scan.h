@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "voice_bitset.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOICE_ALLOCATOR_SCAN_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace VoiceAllocator {
+
+/**
+ * Byte scanning kernels for linear voice layouts (e.g. VoiceNote[VoiceCount]).
+ * The widest instruction set enabled for the build is picked at compile time.
+ */
+namespace Scan {
+
+const size_t NotFound = SIZE_MAX;
+
+/** Index of the first byte equal to value, or NotFound */
+inline size_t find_byte_scalar(const uint8_t* data, size_t size, uint8_t value) {
+    for(size_t i = 0; i < size; i++) {
+        if(data[i] == value) {
+            return i;
+        }
+    }
+    return NotFound;
+}
+
+/** Index of the first byte equal to value, or NotFound */
+inline size_t find_byte(const uint8_t* data, size_t size, uint8_t value) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi8((char)value);
+    for(; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if(mask) {
+            return i + Bits::find_first(mask);
+        }
+    }
+#endif
+
+#if defined(__AVX2__) || defined(VOICE_ALLOCATOR_SCAN_SSE2)
+    const __m128i needle16 = _mm_set1_epi8((char)value);
+    for(; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16));
+        if(mask) {
+            return i + Bits::find_first(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t needle = vdupq_n_u8(value);
+    for(; i + 16 <= size; i += 16) {
+        uint8x16_t equal = vceqq_u8(vld1q_u8(data + i), needle);
+        // Narrow every byte of the compare result to a nibble of a 64-bit mask
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(equal), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if(mask) {
+            return i + Bits::find_first(mask) / 4;
+        }
+    }
+#endif
+
+    size_t tail = find_byte_scalar(data + i, size - i, value);
+    return tail != NotFound ? i + tail : NotFound;
+}
+
+}
+}
+
+#undef VOICE_ALLOCATOR_SCAN_SSE2
@@ -12,8 +12,38 @@ bool test_voice_allocator_mono_high();
 bool test_voice_allocator_mono_low();
 bool test_voice_allocator_mono_newest();
 bool test_voice_allocator_mono_oldest();
+bool test_voice_allocator_mono_high_low_wide_range();
+bool test_voice_allocator_mono_newest_restrike();
+bool test_voice_allocator_mono_newest_sustain();
 bool test_voice_allocator_poly_4_least_recent_used();
 bool test_voice_allocator_poly_4_most_recent_used();
+bool test_voice_allocator_poly_4_same_note_oldest_released_first();
+bool test_voice_allocator_poly_80_free_voice_lookup();
+bool test_voice_allocator_poly_4_fixed_least_recent_used();
+bool test_voice_allocator_poly_4_sink();
+bool test_voice_allocator_poly_2_release_tracking();
+bool test_voice_allocator_poly_4_sustain_sostenuto();
+bool test_voice_allocator_process_poly_4_offsets();
+bool test_voice_allocator_process_unison_overflow();
+bool test_voice_allocator_poly_4_quietest_voice();
+bool test_voice_allocator_poly_4_mpe_channels();
+bool test_voice_allocator_process_mpe_expression();
+bool test_voice_allocator_poly_dynamic_arena();
+bool test_voice_allocator_poly_4_round_robin();
+bool test_voice_allocator_strategy_switch_held_notes();
+bool test_voice_allocator_strategy_switch_channel();
+bool test_voice_allocator_mono_16_broadcast();
+bool test_voice_allocator_poly_7_stacked();
+bool test_voice_allocator_poly_4_stacked_release();
+bool test_voice_allocator_poly_70_active_mask();
+bool test_voice_allocator_poly_4_pedal_channels();
+bool test_velocity_7bit_scaling();
+bool test_scan_find_byte_matches_scalar();
+bool test_queue_overflow_and_drain();
+bool test_queue_threaded_order();
+bool test_pool_split_layer_stealing();
+bool test_pool_note_off_channels();
+bool test_bank_threaded_ranges_match_single_managers();
 
 int main() {
     std::vector<Test> tests = {
@@ -21,8 +51,38 @@ int main() {
         {TEST(test_voice_allocator_mono_low)},
         {TEST(test_voice_allocator_mono_newest)},
         {TEST(test_voice_allocator_mono_oldest)},
+        {TEST(test_voice_allocator_mono_high_low_wide_range)},
+        {TEST(test_voice_allocator_mono_newest_restrike)},
+        {TEST(test_voice_allocator_mono_newest_sustain)},
         {TEST(test_voice_allocator_poly_4_least_recent_used)},
         {TEST(test_voice_allocator_poly_4_most_recent_used)},
+        {TEST(test_voice_allocator_poly_4_same_note_oldest_released_first)},
+        {TEST(test_voice_allocator_poly_80_free_voice_lookup)},
+        {TEST(test_voice_allocator_poly_4_fixed_least_recent_used)},
+        {TEST(test_voice_allocator_poly_4_sink)},
+        {TEST(test_voice_allocator_poly_2_release_tracking)},
+        {TEST(test_voice_allocator_poly_4_sustain_sostenuto)},
+        {TEST(test_voice_allocator_process_poly_4_offsets)},
+        {TEST(test_voice_allocator_process_unison_overflow)},
+        {TEST(test_voice_allocator_poly_4_quietest_voice)},
+        {TEST(test_voice_allocator_poly_4_mpe_channels)},
+        {TEST(test_voice_allocator_process_mpe_expression)},
+        {TEST(test_voice_allocator_poly_dynamic_arena)},
+        {TEST(test_voice_allocator_poly_4_round_robin)},
+        {TEST(test_voice_allocator_strategy_switch_held_notes)},
+        {TEST(test_voice_allocator_strategy_switch_channel)},
+        {TEST(test_voice_allocator_mono_16_broadcast)},
+        {TEST(test_voice_allocator_poly_7_stacked)},
+        {TEST(test_voice_allocator_poly_4_stacked_release)},
+        {TEST(test_voice_allocator_poly_70_active_mask)},
+        {TEST(test_voice_allocator_poly_4_pedal_channels)},
+        {TEST(test_velocity_7bit_scaling)},
+        {TEST(test_scan_find_byte_matches_scalar)},
+        {TEST(test_queue_overflow_and_drain)},
+        {TEST(test_queue_threaded_order)},
+        {TEST(test_pool_split_layer_stealing)},
+        {TEST(test_pool_note_off_channels)},
+        {TEST(test_bank_threaded_ranges_match_single_managers)},
     };
 
     bool success = true;
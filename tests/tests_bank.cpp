@@ -0,0 +1,70 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <voice_manager_bank.h>
+
+using namespace VoiceAllocator;
+
+bool test_bank_threaded_ranges_match_single_managers() {
+    typedef VoiceManagerBank<4, FixedStrategy<PolyLeastRecentlyUsed>> Bank;
+    const size_t instances = 37;
+    const size_t stride = 16;
+    alignas(Constants::CacheLineSize) static uint8_t memory[instances * 1024];
+    alignas(Constants::CacheLineSize) static OutputEvent output[instances * stride];
+    alignas(Constants::CacheLineSize) static size_t output_counts[instances];
+
+    Bank bank;
+    if(!bank.bind(memory, sizeof(memory), instances)) {
+        std::cout << "bind failed, " << Bank::required_bytes(instances) << " bytes" << std::endl;
+        return false;
+    }
+
+    // Instance i plays i % 6 + 1 notes and releases the first one
+    std::vector<InputEvent> events;
+    std::vector<size_t> event_starts;
+    for(size_t i = 0; i < instances; i++) {
+        event_starts.push_back(events.size());
+        size_t notes = i % 6 + 1;
+        for(size_t n = 0; n < notes; n++) {
+            events.push_back({InputEvent::NoteOn, (VoiceNote)(40 + i + n), 100, (uint32_t)n});
+        }
+        events.push_back({InputEvent::NoteOff, (VoiceNote)(40 + i), 0, (uint32_t)notes});
+    }
+    event_starts.push_back(events.size());
+
+    const size_t workers = 3;
+    std::vector<std::thread> threads;
+    for(size_t worker = 0; worker < workers; worker++) {
+        threads.push_back(std::thread([&, worker]() {
+            size_t first, last;
+            bank.split(worker, workers, first, last);
+            bank.process(
+                first, last, events.data(), event_starts.data(), output, stride, output_counts);
+        }));
+    }
+    for(size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    bool success = true;
+    for(size_t i = 0; i < instances; i++) {
+        VoiceManager<4, FixedStrategy<PolyLeastRecentlyUsed>, EventBufferSink> single;
+        OutputEvent expected[stride];
+        size_t start = event_starts[i];
+        size_t count =
+            single.process(&events[start], event_starts[i + 1] - start, expected, stride);
+
+        bool same = count == output_counts[i];
+        for(size_t e = 0; same && e < count; e++) {
+            const OutputEvent& got = output[i * stride + e];
+            same = got.voice == expected[e].voice && got.type == expected[e].type &&
+                   got.note == expected[e].note && got.offset == expected[e].offset;
+        }
+        if(!same) {
+            std::cout << "instance " << i << " differs" << std::endl;
+            success = false;
+        }
+    }
+
+    return success;
+}
@@ -266,4 +266,133 @@ bool test_voice_allocator_mono_oldest() {
     sm.off(2, {0, TestVoice::State::Gate::Closed});
 
     return sm.test(test_states);
-}
\ No newline at end of file
+}
+
+bool test_voice_allocator_mono_high_low_wide_range() {
+    TestVoice test_states;
+    std::vector<TestVoice::State> expected_states;
+    VoiceManager<1> voice_manager;
+    TestStepMaker<1> sm(voice_manager, expected_states);
+
+    void* context[1] = {&test_states};
+
+    voice_manager.set_output_callbacks(callbacks_mono, context);
+    voice_manager.set_strategy(VoiceManager<1>::Strategy::UnisonHighestNote);
+
+    sm.on(10, {10, TestVoice::State::Gate::Open});
+    sm.on(70, {70, TestVoice::State::Gate::Open});
+    sm.on(127, {127, TestVoice::State::Gate::Open});
+    sm.on(70);
+
+    sm.off(127, {70, TestVoice::State::Gate::ReTrigger});
+    sm.off(70, {10, TestVoice::State::Gate::ReTrigger});
+    sm.off(10, {0, TestVoice::State::Gate::Closed});
+
+    voice_manager.set_strategy(VoiceManager<1>::Strategy::UnisonLowestNote);
+
+    sm.on(127, {127, TestVoice::State::Gate::Open});
+    sm.on(64, {64, TestVoice::State::Gate::Open});
+    sm.on(63, {63, TestVoice::State::Gate::Open});
+    sm.on(63);
+
+    sm.off(63, {64, TestVoice::State::Gate::ReTrigger});
+    sm.off(64, {127, TestVoice::State::Gate::ReTrigger});
+    sm.off(127, {0, TestVoice::State::Gate::Closed});
+
+    return sm.test(test_states);
+}
+
+bool test_voice_allocator_mono_newest_restrike() {
+    TestVoice test_states;
+    std::vector<TestVoice::State> expected_states;
+    VoiceManager<1> voice_manager;
+    TestStepMaker<1> sm(voice_manager, expected_states);
+
+    void* context[1] = {&test_states};
+
+    voice_manager.set_output_callbacks(callbacks_mono, context);
+    voice_manager.set_strategy(VoiceManager<1>::Strategy::UnisonNewestNote);
+
+    sm.on(0, {0, TestVoice::State::Gate::Open});
+    sm.on(1, {1, TestVoice::State::Gate::Open});
+    sm.on(2, {2, TestVoice::State::Gate::Open});
+    sm.on(0, {0, TestVoice::State::Gate::Open});
+
+    sm.off(1);
+    sm.off(0, {2, TestVoice::State::Gate::ReTrigger});
+    sm.on(3, {3, TestVoice::State::Gate::Open});
+    sm.off(2);
+    sm.off(3, {0, TestVoice::State::Gate::Closed});
+
+    return sm.test(test_states);
+}
+
+bool test_voice_allocator_mono_newest_sustain() {
+    TestVoice test_states;
+    std::vector<TestVoice::State> expected_states;
+    VoiceManager<1> voice_manager;
+    TestStepMaker<1> sm(voice_manager, expected_states);
+
+    void* context[1] = {&test_states};
+
+    voice_manager.set_output_callbacks(callbacks_mono, context);
+    voice_manager.set_strategy(VoiceManager<1>::Strategy::UnisonNewestNote);
+
+    sm.on(60, {60, TestVoice::State::Gate::Open});
+    sm.on(62, {62, TestVoice::State::Gate::Open});
+    voice_manager.set_sustain(true);
+    sm.off(62);
+    sm.off(60);
+    voice_manager.set_sustain(false);
+    expected_states.push_back({0, TestVoice::State::Gate::Closed});
+
+    sm.on(60, {60, TestVoice::State::Gate::Open});
+    voice_manager.set_sustain(true);
+    sm.on(62, {62, TestVoice::State::Gate::Open});
+    sm.off(62);
+    voice_manager.set_sustain(false);
+    expected_states.push_back({60, TestVoice::State::Gate::ReTrigger});
+    sm.off(60, {0, TestVoice::State::Gate::Closed});
+
+    return sm.test(test_states);
+}
+
+static void start_all(void* context, VoiceNote note, VoiceVelocity) {
+    start(context, note);
+}
+
+static void cont_all(void* context, VoiceNote note, VoiceVelocity) {
+    cont(context, note);
+}
+
+bool test_voice_allocator_mono_16_broadcast() {
+    constexpr size_t num_voices = 16;
+    TestVoice test_states;
+    TestVoice per_voice_states;
+    std::vector<TestVoice::State> expected_states;
+    VoiceManager<num_voices> voice_manager;
+    TestStepMaker<num_voices> sm(voice_manager, expected_states);
+
+    VoiceOutputCallbacks callbacks[num_voices];
+    void* context[num_voices];
+    for(size_t i = 0; i < num_voices; i++) {
+        callbacks[i] = callbacks_mono[0];
+        context[i] = &per_voice_states;
+    }
+    voice_manager.set_output_callbacks(callbacks, context);
+
+    // One call per note change for all 16 voices, the per-voice callbacks stay silent
+    VoiceOutputBroadcastCallbacks broadcast = {
+        .start_all = start_all, .cont_all = cont_all, .stop_all = stop};
+    voice_manager.set_broadcast_callbacks(broadcast, &test_states);
+    voice_manager.set_strategy(VoiceManager<num_voices>::Strategy::UnisonHighestNote);
+
+    sm.on(60, {60, TestVoice::State::Gate::Open});
+    sm.on(64, {64, TestVoice::State::Gate::Open});
+    sm.on(62);
+    sm.off(64, {62, TestVoice::State::Gate::ReTrigger});
+    sm.off(62, {60, TestVoice::State::Gate::ReTrigger});
+    sm.off(60, {0, TestVoice::State::Gate::Closed});
+
+    return sm.test(test_states) && per_voice_states.data.empty();
+}
@@ -105,6 +105,31 @@ static void stop(void* context) {
     test_data->stop();
 }
 
+static bool check_events(
+    const OutputEvent* events,
+    size_t size,
+    const std::vector<OutputEvent>& expected) {
+    bool success = size == expected.size();
+    if(!success) {
+        std::cout << "Size mismatch: " << size << " != " << expected.size() << std::endl;
+    }
+
+    for(size_t i = 0; i < size && i < expected.size(); i++) {
+        if(events[i].voice != expected[i].voice || events[i].type != expected[i].type ||
+           events[i].note != expected[i].note || events[i].velocity != expected[i].velocity ||
+           events[i].offset != expected[i].offset) {
+            std::cout << "x " << i << ": " << events[i].voice << " " << (uint32_t)events[i].type
+                      << " " << (uint32_t)events[i].note << " v" << events[i].velocity << " @"
+                      << events[i].offset << " != " << expected[i].voice << " "
+                      << (uint32_t)expected[i].type << " " << (uint32_t)expected[i].note << " v"
+                      << expected[i].velocity << " @" << expected[i].offset << std::endl;
+            success = false;
+        }
+    }
+
+    return success;
+}
+
 bool test_voice_allocator_poly_4_least_recent_used() {
     constexpr size_t num_voices = 4;
     PolyTestVoice test_states[num_voices];
@@ -231,4 +256,739 @@ bool test_voice_allocator_poly_4_most_recent_used() {
     }
 
     return success;
-}
\ No newline at end of file
+}
+
+bool test_voice_allocator_poly_4_same_note_oldest_released_first() {
+    constexpr size_t num_voices = 4;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    VoiceManager<num_voices> voice_manager;
+
+    VoiceOutputCallbacks callbacks[num_voices] = {
+        {.start = start, .stop = stop},
+        {.start = start, .stop = stop},
+        {.start = start, .stop = stop},
+        {.start = start, .stop = stop},
+    };
+
+    void* context[num_voices] = {
+        &test_states[0],
+        &test_states[1],
+        &test_states[2],
+        &test_states[3],
+    };
+
+    voice_manager.set_output_callbacks(callbacks, context);
+    voice_manager.set_strategy(VoiceManager<num_voices>::Strategy::PolyLeastRecentlyUsed);
+
+    voice_manager.note_on(1);
+    expected_states[0].push_back({.note = 1, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(5);
+    expected_states[1].push_back({.note = 5, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_off(1);
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_on(5);
+    expected_states[0].push_back({.note = 5, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(5);
+    expected_states[2].push_back({.note = 5, .gate = PolyTestVoice::State::Gate::Open});
+
+    voice_manager.note_off(5);
+    expected_states[1].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_off(5);
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_off(5);
+    expected_states[2].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_off(5);
+
+    bool success = true;
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_80_free_voice_lookup() {
+    constexpr size_t num_voices = 80;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    VoiceManager<num_voices> voice_manager;
+
+    VoiceOutputCallbacks callbacks[num_voices];
+    void* context[num_voices];
+    for(size_t i = 0; i < num_voices; i++) {
+        callbacks[i] = {.start = start, .cont = nullptr, .stop = stop};
+        context[i] = &test_states[i];
+    }
+
+    voice_manager.set_output_callbacks(callbacks, context);
+    voice_manager.set_strategy(VoiceManager<num_voices>::Strategy::PolyLeastRecentlyUsed);
+
+    for(size_t i = 0; i < num_voices; i++) {
+        voice_manager.note_on(i);
+        expected_states[i].push_back(
+            {.note = (VoiceNote)i, .gate = PolyTestVoice::State::Gate::Open});
+    }
+
+    bool success = !voice_manager.has_free_voice();
+
+    voice_manager.note_off(70);
+    expected_states[70].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    success = success && voice_manager.has_free_voice();
+    voice_manager.note_off(10);
+    expected_states[10].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    voice_manager.note_on(100);
+    expected_states[10].push_back({.note = 100, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(101);
+    expected_states[70].push_back({.note = 101, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(102);
+    expected_states[0].push_back({.note = 102, .gate = PolyTestVoice::State::Gate::Open});
+
+    success = success && !voice_manager.has_free_voice();
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_4_fixed_least_recent_used() {
+    constexpr size_t num_voices = 4;
+    typedef VoiceManager<num_voices, FixedStrategy<PolyLeastRecentlyUsed>> FixedVoiceManager;
+    static_assert(
+        sizeof(FixedVoiceManager) + sizeof(NoteStack) <= sizeof(VoiceManager<num_voices>),
+        "poly managers with a fixed strategy must not carry a NoteStack");
+
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    FixedVoiceManager voice_manager;
+
+    VoiceOutputCallbacks callbacks[num_voices] = {
+        {.start = start, .stop = stop},
+        {.start = start, .stop = stop},
+        {.start = start, .stop = stop},
+        {.start = start, .stop = stop},
+    };
+
+    void* context[num_voices] = {
+        &test_states[0],
+        &test_states[1],
+        &test_states[2],
+        &test_states[3],
+    };
+
+    voice_manager.set_output_callbacks(callbacks, context);
+
+    for(size_t i = 0; i < 6; i++) {
+        voice_manager.note_on(i);
+        expected_states[i % num_voices].push_back(
+            {.note = (VoiceNote)i, .gate = PolyTestVoice::State::Gate::Open});
+    }
+
+    voice_manager.note_off(2);
+    expected_states[2].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_on(6);
+    expected_states[2].push_back({.note = 6, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(7);
+    expected_states[3].push_back({.note = 7, .gate = PolyTestVoice::State::Gate::Open});
+
+    bool success = true;
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+struct PolyTestSink {
+    PolyTestVoice* voices;
+
+    void start(size_t voice, VoiceNote note, VoiceVelocity) {
+        voices[voice].start(note);
+    }
+
+    void cont(size_t voice, VoiceNote note, VoiceVelocity) {
+        voices[voice].start(note);
+    }
+
+    void stop(size_t voice) {
+        voices[voice].stop();
+    }
+
+    void expression(size_t, VoiceExpression, VoiceExpressionValue) {
+    }
+};
+
+bool test_voice_allocator_poly_4_sink() {
+    constexpr size_t num_voices = 4;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    PolyTestSink sink = {test_states};
+    VoiceManager<num_voices, DynamicStrategy, PolyTestSink> voice_manager(sink);
+
+    voice_manager.set_strategy(VoiceManager<num_voices>::Strategy::PolyMostRecentlyUsed);
+
+    for(size_t i = 0; i < 6; i++) {
+        voice_manager.note_on(i);
+        expected_states[std::min(i, num_voices - 1)].push_back(
+            {.note = (VoiceNote)i, .gate = PolyTestVoice::State::Gate::Open});
+    }
+
+    voice_manager.note_off(5);
+    expected_states[3].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_off(0);
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    bool success = true;
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_2_release_tracking() {
+    constexpr size_t num_voices = 2;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    PolyTestSink sink = {test_states};
+    VoiceManager<num_voices, DynamicStrategy, PolyTestSink> voice_manager(sink);
+
+    voice_manager.set_strategy(VoiceManager<num_voices>::Strategy::PolyLeastRecentlyUsed);
+    voice_manager.set_release_tracking(true);
+
+    bool success = true;
+
+    voice_manager.note_on(60);
+    expected_states[0].push_back({.note = 60, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(62);
+    expected_states[1].push_back({.note = 62, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_off(60);
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    success = success && voice_manager.voice_state(0) == VoiceReleasing;
+
+    // No idle voice: the releasing voice is taken before the held one
+    voice_manager.note_on(64);
+    expected_states[0].push_back({.note = 64, .gate = PolyTestVoice::State::Gate::Open});
+
+    voice_manager.note_off(62);
+    expected_states[1].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_off(64);
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.voice_finished(0);
+    success = success && voice_manager.voice_state(0) == VoiceIdle;
+
+    // Idle voice first, even though voice 1 has been releasing longer
+    voice_manager.note_on(65);
+    expected_states[0].push_back({.note = 65, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(67);
+    expected_states[1].push_back({.note = 67, .gate = PolyTestVoice::State::Gate::Open});
+    success = success && voice_manager.voice_state(1) == VoiceActive;
+
+    // Both held: steal the least recently used
+    voice_manager.note_on(69);
+    expected_states[0].push_back({.note = 69, .gate = PolyTestVoice::State::Gate::Open});
+
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_4_quietest_voice() {
+    constexpr size_t num_voices = 4;
+    VoiceManager<num_voices, FixedStrategy<PolyQuietestVoice>, EventBufferSink> voice_manager;
+
+    OutputEvent output[8];
+    voice_manager.sink().set_buffer(output, 8);
+
+    voice_manager.note_on(60, 30000);
+    voice_manager.note_on(62, 10000);
+    voice_manager.note_on(64, 50000);
+    voice_manager.note_on(65, 20000);
+
+    // Levels start at the note velocity
+    voice_manager.note_on(67, 40000);
+
+    // Then follow what the synth reports
+    voice_manager.set_voice_level(2, 500);
+    voice_manager.note_on(69, 45000);
+    voice_manager.set_voice_level(0, 1000);
+    voice_manager.note_on(71, velocity_from_7bit(127));
+
+    std::vector<OutputEvent> expected = {
+        {0, OutputEvent::Start, 60, 30000, 0},
+        {1, OutputEvent::Start, 62, 10000, 0},
+        {2, OutputEvent::Start, 64, 50000, 0},
+        {3, OutputEvent::Start, 65, 20000, 0},
+        {1, OutputEvent::Start, 67, 40000, 0},
+        {2, OutputEvent::Start, 69, 45000, 0},
+        {0, OutputEvent::Start, 71, 0xFFFF, 0},
+    };
+
+    // Voice indices out of range are ignored or report a silent voice
+    voice_manager.set_voice_level(Constants::InvalidVoice, 0);
+    voice_manager.voice_finished(num_voices);
+    bool success = voice_manager.voice_state(Constants::InvalidVoice) == VoiceIdle &&
+                   voice_manager.voice_note(num_voices).note == Constants::InvalidNote &&
+                   voice_manager.voice_note(voice_manager.find_voice(NoteId{0, 100})).note ==
+                       Constants::InvalidNote;
+
+    success = check_events(output, voice_manager.sink().size(), expected) && success;
+
+    // Levels reported under another strategy count once the strategy switches over
+    VoiceManager<num_voices, DynamicStrategy, EventBufferSink> dynamic_manager;
+    dynamic_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+    dynamic_manager.sink().set_buffer(output, 8);
+    for(size_t i = 0; i < num_voices; i++) {
+        dynamic_manager.note_on(60 + i, 30000);
+    }
+    dynamic_manager.set_voice_level(2, 100);
+    dynamic_manager.set_strategy(Strategy::PolyQuietestVoice);
+    dynamic_manager.note_on(70, 30000);
+    success = success && dynamic_manager.voice_note(2).note == 70;
+
+    return success;
+}
+
+bool test_velocity_7bit_scaling() {
+    return velocity_from_7bit(0) == 0 && velocity_from_7bit(1) == 0x200 &&
+           velocity_from_7bit(64) == Constants::DefaultVelocity &&
+           velocity_from_7bit(127) == 0xFFFF && velocity_to_7bit(velocity_from_7bit(100)) == 100;
+}
+
+bool test_voice_allocator_poly_4_sustain_sostenuto() {
+    constexpr size_t num_voices = 4;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    PolyTestSink sink = {test_states};
+    VoiceManager<num_voices, DynamicStrategy, PolyTestSink> voice_manager(sink);
+
+    voice_manager.set_strategy(VoiceManager<num_voices>::Strategy::PolyLeastRecentlyUsed);
+
+    voice_manager.note_on(60);
+    expected_states[0].push_back({.note = 60, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(62);
+    expected_states[1].push_back({.note = 62, .gate = PolyTestVoice::State::Gate::Open});
+
+    voice_manager.control_change(Controllers::Sustain, 127);
+    voice_manager.note_off(60);
+    voice_manager.note_off(62);
+
+    // Re-strike reuses the sustained voice
+    voice_manager.note_on(60);
+    expected_states[0].push_back({.note = 60, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(64);
+    expected_states[2].push_back({.note = 64, .gate = PolyTestVoice::State::Gate::Open});
+
+    voice_manager.control_change(Controllers::Sustain, 0);
+    expected_states[1].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    voice_manager.note_on(65);
+    expected_states[1].push_back({.note = 65, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.set_sostenuto(true);
+    voice_manager.note_off(65);
+    voice_manager.note_on(67);
+    expected_states[3].push_back({.note = 67, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_off(67);
+    expected_states[3].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.set_sostenuto(false);
+    expected_states[1].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    bool success = true;
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_4_mpe_channels() {
+    constexpr size_t num_voices = 4;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    PolyTestSink sink = {test_states};
+    VoiceManager<num_voices, DynamicStrategy, PolyTestSink> voice_manager(sink);
+
+    voice_manager.set_strategy(VoiceManager<num_voices>::Strategy::PolyLeastRecentlyUsed);
+    voice_manager.set_mpe_zones(3, 0);
+
+    bool success = true;
+    success = success && voice_manager.mpe().is_master(0);
+    success = success && voice_manager.mpe().zone(3) == MpeLowerZone;
+    success = success && voice_manager.mpe().zone(4) == MpeNoZone;
+
+    // The same note on two member channels is two notes
+    voice_manager.note_on(60, Constants::DefaultVelocity, 1);
+    expected_states[0].push_back({.note = 60, .gate = PolyTestVoice::State::Gate::Open});
+    voice_manager.note_on(60, Constants::DefaultVelocity, 2);
+    expected_states[1].push_back({.note = 60, .gate = PolyTestVoice::State::Gate::Open});
+
+    success = success && voice_manager.find_voice(NoteId{1, 60}) == 0;
+    success = success && voice_manager.find_voice(NoteId{2, 60}) == 1;
+    success = success && voice_manager.find_voice(NoteId{3, 60}) == Constants::InvalidVoice;
+    success = success && voice_manager.find_voice((VoiceChannel)2) == 1;
+    success = success && voice_manager.voice_note(1).channel == 2;
+
+    voice_manager.note_off(60, 2);
+    expected_states[1].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    success = success && voice_manager.find_voice((VoiceChannel)2) == Constants::InvalidVoice;
+
+    voice_manager.note_off(60, 1);
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    // A single zone takes all 15 member channels, two zones share 14
+    voice_manager.set_mpe_zones(15, 0);
+    success = success && voice_manager.mpe().zone(15) == MpeLowerZone;
+    voice_manager.set_mpe_zones(15, 3);
+    success = success && voice_manager.mpe().members(MpeUpperZone) == 0;
+    success = success && voice_manager.mpe().members(MpeLowerZone) == 15;
+    voice_manager.set_mpe_zones(10, 15);
+    success = success && voice_manager.mpe().zone(11) == MpeUpperZone;
+    success = success && voice_manager.mpe().zone(10) == MpeLowerZone;
+    voice_manager.set_mpe_zones(0, 15);
+    success = success && voice_manager.mpe().zone(0) == MpeUpperZone;
+
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_dynamic_arena() {
+    typedef VoiceManager<Constants::DynamicVoiceCount, DynamicStrategy, PolyTestSink> Manager;
+    constexpr size_t max_voices = 4;
+    PolyTestVoice test_states[max_voices];
+    std::vector<PolyTestVoice::State> expected_states[max_voices];
+    PolyTestSink sink = {test_states};
+    Manager voice_manager(sink);
+    voice_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+
+    std::vector<uint64_t> arena(Manager::required_bytes(max_voices) / sizeof(uint64_t) + 1);
+    size_t arena_bytes = arena.size() * sizeof(uint64_t);
+
+    bool success = true;
+    success = success && !voice_manager.set_voices(arena.data(), 8, max_voices);
+    success = success && voice_manager.voice_count() == 0;
+
+    // No voices yet: notes are ignored
+    voice_manager.note_on(48);
+
+    success = success && voice_manager.set_voices(arena.data(), arena_bytes, 3);
+    for(size_t i = 0; i < 4; i++) {
+        voice_manager.note_on(60 + i);
+    }
+    expected_states[0].push_back({.note = 60, .gate = PolyTestVoice::State::Gate::Open});
+    expected_states[1].push_back({.note = 61, .gate = PolyTestVoice::State::Gate::Open});
+    expected_states[2].push_back({.note = 62, .gate = PolyTestVoice::State::Gate::Open});
+    expected_states[0].push_back({.note = 63, .gate = PolyTestVoice::State::Gate::Open});
+
+    // Growing the polyphony in the same arena stops the sounding voices
+    success = success && voice_manager.set_voices(arena.data(), arena_bytes, max_voices);
+    success = success && voice_manager.voice_count() == max_voices;
+    expected_states[1].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    expected_states[2].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    for(size_t i = 0; i < 4; i++) {
+        voice_manager.note_on(70 + i);
+        expected_states[i].push_back(
+            {.note = (VoiceNote)(70 + i), .gate = PolyTestVoice::State::Gate::Open});
+    }
+    voice_manager.note_off(72);
+    expected_states[2].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    for(size_t i = 0; i < max_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_4_round_robin() {
+    constexpr size_t num_voices = 4;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    PolyTestSink sink = {test_states};
+    VoiceManager<num_voices, FixedStrategy<PolyRoundRobin>, PolyTestSink> voice_manager(sink);
+
+    for(size_t i = 0; i < num_voices; i++) {
+        voice_manager.note_on(60 + i);
+        expected_states[i].push_back(
+            {.note = (VoiceNote)(60 + i), .gate = PolyTestVoice::State::Gate::Open});
+    }
+
+    // The cursor wrapped to voice 0, which is busy: skip to the free voice 1
+    voice_manager.note_off(61);
+    expected_states[1].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_on(64);
+    expected_states[1].push_back({.note = 64, .gate = PolyTestVoice::State::Gate::Open});
+
+    // All busy: steal at the cursor
+    voice_manager.note_on(65);
+    expected_states[2].push_back({.note = 65, .gate = PolyTestVoice::State::Gate::Open});
+
+    // The free voice 0 is found by wrapping around past the cursor
+    voice_manager.note_off(60);
+    expected_states[0].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    voice_manager.note_on(66);
+    expected_states[0].push_back({.note = 66, .gate = PolyTestVoice::State::Gate::Open});
+
+    bool success = true;
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_strategy_switch_held_notes() {
+    constexpr size_t num_voices = 4;
+    VoiceManager<num_voices, DynamicStrategy, EventBufferSink> voice_manager;
+    voice_manager.set_strategy(Strategy::UnisonNewestNote);
+
+    OutputEvent output[16];
+    voice_manager.sink().set_buffer(output, 16);
+    voice_manager.note_on(60, 100);
+    voice_manager.note_on(64, 100);
+    voice_manager.note_on(67, 100);
+
+    bool success = true;
+
+    // Unison to unison: the voices glide to the new pick
+    voice_manager.sink().set_buffer(output, 16);
+    voice_manager.set_strategy(Strategy::UnisonLowestNote);
+    std::vector<OutputEvent> expected = {
+        {0, OutputEvent::Continue, 60, 100, 0},
+        {1, OutputEvent::Continue, 60, 100, 0},
+        {2, OutputEvent::Continue, 60, 100, 0},
+        {3, OutputEvent::Continue, 60, 100, 0},
+    };
+    success = check_events(output, voice_manager.sink().size(), expected) && success;
+
+    // Unison to poly: voice 0 keeps sounding, the other held notes take voices 1 and 2
+    voice_manager.sink().set_buffer(output, 16);
+    voice_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+    expected = {
+        {1, OutputEvent::Start, 64, 100, 0},
+        {2, OutputEvent::Start, 67, 100, 0},
+        {3, OutputEvent::Stop, Constants::InvalidNote, 0, 0},
+    };
+    success = check_events(output, voice_manager.sink().size(), expected) && success;
+
+    // Poly to poly keeps the voices as they are
+    voice_manager.sink().set_buffer(output, 16);
+    voice_manager.set_strategy(Strategy::PolyRoundRobin);
+    success = voice_manager.sink().size() == 0 && success;
+
+    // Poly to unison: idle voices start, busy ones continue, voice 2 already plays the pick
+    voice_manager.note_off(64);
+    voice_manager.sink().set_buffer(output, 16);
+    voice_manager.set_strategy(Strategy::UnisonHighestNote);
+    expected = {
+        {0, OutputEvent::Continue, 67, 100, 0},
+        {1, OutputEvent::Start, 67, 100, 0},
+        {3, OutputEvent::Start, 67, 100, 0},
+    };
+    success = check_events(output, voice_manager.sink().size(), expected) && success;
+
+    return success;
+}
+
+bool test_voice_allocator_strategy_switch_channel() {
+    constexpr size_t num_voices = 4;
+    VoiceManager<num_voices, DynamicStrategy, EventBufferSink> voice_manager;
+    voice_manager.set_strategy(Strategy::UnisonNewestNote);
+
+    OutputEvent output[16];
+    voice_manager.sink().set_buffer(output, 16);
+    voice_manager.note_on(60, 100, 2);
+    voice_manager.note_on(64, 100, 2);
+
+    // The held notes keep their channel: voice 0 goes on without a new start
+    voice_manager.sink().set_buffer(output, 16);
+    voice_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+    std::vector<OutputEvent> expected = {
+        {1, OutputEvent::Start, 60, 100, 0},
+        {2, OutputEvent::Stop, Constants::InvalidNote, 0, 0},
+        {3, OutputEvent::Stop, Constants::InvalidNote, 0, 0},
+    };
+    bool success = check_events(output, voice_manager.sink().size(), expected);
+    success = success && voice_manager.find_voice(NoteId{2, 64}) == 0;
+
+    voice_manager.note_off(64, 2);
+    voice_manager.note_off(60, 2);
+    success = success && voice_manager.active_count() == 0;
+
+    return success;
+}
+
+bool test_voice_allocator_poly_7_stacked() {
+    constexpr size_t num_voices = 7;
+    PolyTestVoice test_states[num_voices];
+    std::vector<PolyTestVoice::State> expected_states[num_voices];
+    PolyTestSink sink = {test_states};
+    VoiceManager<num_voices, StackedStrategy<2>, PolyTestSink> voice_manager(sink);
+
+    // Three groups of two voices, voice 6 is left over and never used
+    for(size_t i = 0; i < 3; i++) {
+        voice_manager.note_on(60 + i);
+        for(size_t voice = i * 2; voice < i * 2 + 2; voice++) {
+            expected_states[voice].push_back(
+                {.note = (VoiceNote)(60 + i), .gate = PolyTestVoice::State::Gate::Open});
+        }
+    }
+
+    // All groups busy: the least recently used group is stolen as a whole
+    voice_manager.note_on(63);
+    expected_states[0].push_back({.note = 63, .gate = PolyTestVoice::State::Gate::Open});
+    expected_states[1].push_back({.note = 63, .gate = PolyTestVoice::State::Gate::Open});
+
+    voice_manager.note_off(61);
+    expected_states[2].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+    expected_states[3].push_back({.note = 0, .gate = PolyTestVoice::State::Gate::Closed});
+
+    voice_manager.note_on(64);
+    expected_states[2].push_back({.note = 64, .gate = PolyTestVoice::State::Gate::Open});
+    expected_states[3].push_back({.note = 64, .gate = PolyTestVoice::State::Gate::Open});
+
+    bool success = true;
+    for(size_t i = 0; i < num_voices; i++) {
+        if(test_states[i].data != expected_states[i]) {
+            test_states[i].dump_states_diff(expected_states[i]);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_70_active_mask() {
+    constexpr size_t num_voices = 70;
+    VoiceManager<num_voices, FixedStrategy<PolyLeastRecentlyUsed>, EventBufferSink> voice_manager;
+    voice_manager.set_release_tracking(true);
+
+    // Fill the first word and two voices of the second
+    for(size_t i = 0; i < 66; i++) {
+        voice_manager.note_on(i);
+    }
+
+    // A releasing voice still sounds until the synth reports it finished
+    voice_manager.note_off(1);
+    voice_manager.note_off(65);
+    voice_manager.voice_finished(65);
+
+    std::vector<size_t> active;
+    voice_manager.for_each_active([&](size_t voice) { active.push_back(voice); });
+
+    BitSet<num_voices> mask = voice_manager.active_mask();
+    bool success = active.size() == 65 && voice_manager.active_count() == 65 &&
+                   active.front() == 0 && active.back() == 64 && mask.test(1) &&
+                   !mask.test(65) && mask.find_last() == 64;
+    if(!success) {
+        std::cout << "active " << active.size() << " count " << voice_manager.active_count()
+                  << std::endl;
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_4_pedal_channels() {
+    VoiceManager<4, FixedStrategy<PolyLeastRecentlyUsed>, EventBufferSink> voice_manager;
+    OutputEvent output[16];
+    voice_manager.sink().set_buffer(output, 16);
+
+    // The same note struck on another channel does not take over the sustained voice
+    voice_manager.note_on(60, Constants::DefaultVelocity, 0);
+    voice_manager.set_sustain(true);
+    voice_manager.note_off(60, 0);
+    voice_manager.note_on(60, Constants::DefaultVelocity, 1);
+    voice_manager.note_off(60, 1);
+    voice_manager.set_sustain(false);
+
+    bool success = voice_manager.active_count() == 0;
+
+    // Pedal-up releases the sustained channel only, the key held on the other one sounds on
+    voice_manager.note_on(62, Constants::DefaultVelocity, 1);
+    voice_manager.note_on(62, Constants::DefaultVelocity, 2);
+    voice_manager.set_sustain(true);
+    voice_manager.note_off(62, 1);
+    voice_manager.set_sustain(false);
+
+    success = success && voice_manager.active_count() == 1 &&
+              voice_manager.find_voice(NoteId{2, 62}) != Constants::InvalidVoice;
+
+    voice_manager.note_off(62, 2);
+    success = success && voice_manager.active_count() == 0;
+    if(!success) {
+        std::cout << "active " << voice_manager.active_count() << std::endl;
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_poly_4_stacked_release() {
+    VoiceManager<4, DynamicStrategy, EventBufferSink> voice_manager;
+    OutputEvent output[16];
+    voice_manager.sink().set_buffer(output, 16);
+
+    // Regrouping keeps the note on its channel
+    voice_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+    voice_manager.set_stack_size(2);
+    voice_manager.note_on(60, Constants::DefaultVelocity, 5);
+    voice_manager.set_strategy(Strategy::PolyStacked);
+    bool success = voice_manager.active_count() == 2;
+    voice_manager.note_off(60, 5);
+    success = success && voice_manager.active_count() == 0;
+
+    // A group with a releasing voice is passed over while another group is idle
+    voice_manager.reset();
+    voice_manager.set_release_tracking(true);
+    voice_manager.note_on(60);
+    voice_manager.note_off(60);
+    voice_manager.voice_finished(0);
+    voice_manager.note_on(62);
+    success = success && voice_manager.voice_note(2).note == 62 &&
+              voice_manager.voice_note(3).note == 62 &&
+              voice_manager.voice_state(1) == VoiceReleasing;
+
+    // Without an idle group the released group is taken before a playing one
+    voice_manager.note_on(64);
+    success = success && voice_manager.voice_note(0).note == 64 &&
+              voice_manager.voice_note(1).note == 64;
+    if(!success) {
+        std::cout << "active " << voice_manager.active_count() << std::endl;
+    }
+
+    return success;
+}
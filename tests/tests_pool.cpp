@@ -0,0 +1,79 @@
+#include <iostream>
+#include <vector>
+#include <voice_pool.h>
+
+using namespace VoiceAllocator;
+
+bool test_pool_split_layer_stealing() {
+    VoicePool<4, 2, EventBufferSink> pool;
+    OutputEvent output[16];
+    pool.sink().set_buffer(output, 16);
+
+    // A bass split with one reserved voice under a pad layered over the whole keyboard
+    const size_t bass = 0;
+    const size_t pad = 1;
+    pool.set_zone(bass, {0, 59, Constants::AllChannels, 1, 4, 1});
+    pool.set_zone(pad, {0, 127, Constants::AllChannels, 0, 3, 0});
+
+    pool.note_on(40, 100);
+    pool.note_on(72, 100);
+    pool.note_on(74, 100);
+
+    // The pad is at its limit and steals its own oldest voice
+    pool.note_on(76, 100);
+
+    // The bass steals the oldest pad voice, the pad cannot outrank the bass and steals its own
+    pool.note_on(41, 100);
+
+    pool.note_off(41);
+
+    std::vector<OutputEvent> expected = {
+        {0, OutputEvent::Start, 40, 100, 0},
+        {1, OutputEvent::Start, 40, 100, 0},
+        {2, OutputEvent::Start, 72, 100, 0},
+        {3, OutputEvent::Start, 74, 100, 0},
+        {1, OutputEvent::Start, 76, 100, 0},
+        {2, OutputEvent::Start, 41, 100, 0},
+        {3, OutputEvent::Start, 41, 100, 0},
+        {2, OutputEvent::Stop, Constants::InvalidNote, 0, 0},
+        {3, OutputEvent::Stop, Constants::InvalidNote, 0, 0},
+    };
+
+    bool success = pool.sink().size() == expected.size();
+    for(size_t i = 0; i < pool.sink().size() && i < expected.size(); i++) {
+        if(output[i].voice != expected[i].voice || output[i].type != expected[i].type ||
+           output[i].note != expected[i].note) {
+            std::cout << "x " << i << ": " << output[i].voice << " " << (uint32_t)output[i].type
+                      << " " << (uint32_t)output[i].note << std::endl;
+            success = false;
+        }
+    }
+
+    return success && pool.part_voices(bass) == 1 && pool.part_voices(pad) == 1 &&
+           pool.part_of(2) == Constants::NoPart && pool.part_of(1) == pad;
+}
+
+bool test_pool_note_off_channels() {
+    VoicePool<4, 1, EventBufferSink> pool;
+    OutputEvent output[16];
+    pool.sink().set_buffer(output, 16);
+    pool.set_zone(0, {0, 127, 1 << 1, 0, 4, 0});
+
+    // Channel 17 wraps onto channel 1, so it is the same note as on channel 1
+    pool.note_on(60, 100, 17);
+    pool.note_on(60, 100, 1);
+
+    // Notes above 127 are clamped like part_note_on() does
+    pool.note_on(200, 100, 1);
+
+    // The oldest voice on the note and channel stops
+    pool.note_off(60, 1);
+    pool.note_off(60, 17);
+    pool.note_off(127, 1);
+
+    return pool.sink().size() == 6 && output[2].note == 127 && output[3].voice == 0 &&
+           output[3].type == OutputEvent::Stop && output[4].voice == 1 &&
+           output[4].type == OutputEvent::Stop && output[5].voice == 2 &&
+           output[5].type == OutputEvent::Stop && pool.part_voices(0) == 0 &&
+           pool.voice_note(0).channel == 1;
+}
@@ -0,0 +1,155 @@
+#include <iostream>
+#include <vector>
+#include <voice_allocator.h>
+
+using namespace VoiceAllocator;
+
+static bool check_events(
+    const OutputEvent* events,
+    size_t size,
+    const std::vector<OutputEvent>& expected) {
+    bool success = size == expected.size();
+    if(!success) {
+        std::cout << "Size mismatch: " << size << " != " << expected.size() << std::endl;
+    }
+
+    for(size_t i = 0; i < size && i < expected.size(); i++) {
+        if(events[i].voice != expected[i].voice || events[i].type != expected[i].type ||
+           events[i].note != expected[i].note || events[i].velocity != expected[i].velocity ||
+           events[i].offset != expected[i].offset) {
+            std::cout << "x " << i << ": " << events[i].voice << " " << (uint32_t)events[i].type
+                      << " " << (uint32_t)events[i].note << " v" << events[i].velocity << " @"
+                      << events[i].offset << " != " << expected[i].voice << " "
+                      << (uint32_t)expected[i].type << " " << (uint32_t)expected[i].note << " v"
+                      << expected[i].velocity << " @" << expected[i].offset << std::endl;
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_voice_allocator_process_poly_4_offsets() {
+    constexpr size_t num_voices = 4;
+    VoiceManager<num_voices, DynamicStrategy, EventBufferSink> voice_manager;
+    voice_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+
+    InputEvent input[] = {
+        {InputEvent::NoteOn, 60, 100, 0},
+        {InputEvent::NoteOn, 64, 100, 0},
+        {InputEvent::NoteOn, 67, 100, 5},
+        {InputEvent::NoteOff, 64, 0, 12},
+        {InputEvent::NoteOn, 72, 100, 12},
+        {InputEvent::NoteOn, 76, 100, 30},
+        {InputEvent::NoteOn, 79, 100, 29},
+    };
+    const size_t input_count = sizeof(input) / sizeof(input[0]);
+
+    OutputEvent output[num_voices * input_count];
+    size_t output_count = voice_manager.process(
+        input, input_count, output, voice_manager.output_capacity(input_count));
+
+    std::vector<OutputEvent> expected = {
+        {0, OutputEvent::Start, 60, 100, 0},
+        {1, OutputEvent::Start, 64, 100, 0},
+        {2, OutputEvent::Start, 67, 100, 5},
+        {1, OutputEvent::Stop, Constants::InvalidNote, 0, 12},
+        {1, OutputEvent::Start, 72, 100, 12},
+        {3, OutputEvent::Start, 76, 100, 30},
+        {0, OutputEvent::Start, 79, 100, 30},
+    };
+
+    return check_events(output, output_count, expected) && voice_manager.sink().dropped() == 0;
+}
+
+bool test_voice_allocator_process_unison_overflow() {
+    constexpr size_t num_voices = 2;
+    VoiceManager<num_voices, FixedStrategy<UnisonNewestNote>, EventBufferSink> voice_manager;
+
+    InputEvent input[] = {
+        {InputEvent::NoteOn, 60, 100, 0},
+        {InputEvent::NoteOn, 62, 90, 0},
+        {InputEvent::NoteOff, 62, 0, 0},
+    };
+
+    OutputEvent output[5];
+    size_t output_count = voice_manager.process(input, 3, output, 5);
+
+    std::vector<OutputEvent> expected = {
+        {0, OutputEvent::Start, 60, 100, 0},
+        {1, OutputEvent::Start, 60, 100, 0},
+        {0, OutputEvent::Start, 62, 90, 0},
+        {1, OutputEvent::Start, 62, 90, 0},
+        {0, OutputEvent::Continue, 60, 100, 0},
+    };
+
+    return check_events(output, output_count, expected) && voice_manager.sink().dropped() == 1;
+}
+
+bool test_voice_allocator_process_mpe_expression() {
+    constexpr size_t num_voices = 4;
+    VoiceManager<num_voices, DynamicStrategy, EventBufferSink> voice_manager;
+    voice_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+    voice_manager.set_mpe_zones(3, 0);
+
+    InputEvent input[] = {
+        {InputEvent::NoteOn, 60, 100, 0, 1},
+        {InputEvent::NoteOn, 60, 100, 0, 2},
+        {InputEvent::NoteOn, 64, 100, 0, 4},
+        {InputEvent::PolyPressure, 60, 1000, 1, 2},
+        {InputEvent::PitchBend, 0, 0x9000, 2, 1},
+        {InputEvent::ControlChange, Controllers::Timbre, 127, 3, 2},
+        {InputEvent::PitchBend, 0, 0x7000, 4, 0},
+        {InputEvent::ChannelPressure, 0, 500, 5, 4},
+    };
+    const size_t input_count = sizeof(input) / sizeof(input[0]);
+
+    OutputEvent output[num_voices * input_count];
+    size_t output_count = voice_manager.process(
+        input, input_count, output, voice_manager.output_capacity(input_count));
+
+    std::vector<OutputEvent> expected = {
+        {0, OutputEvent::Start, 60, 100, 0},
+        {1, OutputEvent::Start, 60, 100, 0},
+        {2, OutputEvent::Start, 64, 100, 0},
+        {1, OutputEvent::Expression, ExpressionPressure, 1000, 1},
+        {0, OutputEvent::Expression, ExpressionPitchBend, 0x9000, 2},
+        {1, OutputEvent::Expression, ExpressionTimbre, 0xFFFF, 3},
+        // Master channel bend reaches the zone only
+        {0, OutputEvent::Expression, ExpressionPitchBend, 0x7000, 4},
+        {1, OutputEvent::Expression, ExpressionPitchBend, 0x7000, 4},
+        {2, OutputEvent::Expression, ExpressionPressure, 500, 5},
+    };
+
+    bool success =
+        check_events(output, output_count, expected) && voice_manager.sink().dropped() == 0;
+
+    // Unison voices take the member channel of the note and all follow its expression
+    voice_manager.reset();
+    voice_manager.set_strategy(Strategy::UnisonNewestNote);
+    voice_manager.set_mpe_zones(15, 0);
+
+    InputEvent unison_input[] = {
+        {InputEvent::NoteOn, 60, 100, 0, 3},
+        {InputEvent::PitchBend, 0, 0x9000, 1, 3},
+    };
+    const size_t unison_count = sizeof(unison_input) / sizeof(unison_input[0]);
+    output_count = voice_manager.process(
+        unison_input, unison_count, output, voice_manager.output_capacity(unison_count));
+
+    expected = {
+        {0, OutputEvent::Start, 60, 100, 0},
+        {1, OutputEvent::Start, 60, 100, 0},
+        {2, OutputEvent::Start, 60, 100, 0},
+        {3, OutputEvent::Start, 60, 100, 0},
+        {0, OutputEvent::Expression, ExpressionPitchBend, 0x9000, 1},
+        {1, OutputEvent::Expression, ExpressionPitchBend, 0x9000, 1},
+        {2, OutputEvent::Expression, ExpressionPitchBend, 0x9000, 1},
+        {3, OutputEvent::Expression, ExpressionPitchBend, 0x9000, 1},
+    };
+    success = check_events(output, output_count, expected) && success;
+    success = success && voice_manager.voice_note(0).channel == 3 &&
+              voice_manager.find_voice((VoiceChannel)3) != Constants::InvalidVoice;
+
+    return success;
+}
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <thread>
+#include <voice_event_queue.h>
+
+using namespace VoiceAllocator;
+
+bool test_queue_overflow_and_drain() {
+    static VoiceEventQueue<4> queue;
+    VoiceManager<2, DynamicStrategy, EventBufferSink> voice_manager;
+    voice_manager.set_strategy(Strategy::PolyLeastRecentlyUsed);
+
+    bool success = true;
+    for(VoiceNote note = 60; note < 64; note++) {
+        InputEvent event = {InputEvent::NoteOn, note, 100, 0};
+        success = success && queue.push(event);
+    }
+
+    InputEvent extra = {InputEvent::NoteOn, 64, 100, 0};
+    if(queue.push(extra) || queue.overflows() != 1) {
+        std::cout << "overflow not reported" << std::endl;
+        success = false;
+    }
+
+    OutputEvent output[4];
+    voice_manager.sink().set_buffer(output, 4);
+    size_t handled = drain(queue, voice_manager);
+
+    if(handled != 4 || !queue.empty() || voice_manager.sink().size() != 4) {
+        std::cout << "drained " << handled << " events, " << voice_manager.sink().size()
+                  << " voice events" << std::endl;
+        success = false;
+    }
+
+    return success && output[3].voice == 1 && output[3].note == 63;
+}
+
+bool test_queue_threaded_order() {
+    static SpscQueue<uint32_t, 64> queue;
+    const uint32_t count = 20000;
+
+    std::thread producer([&]() {
+        for(uint32_t i = 0; i < count; i++) {
+            while(!queue.push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    bool success = true;
+    uint32_t expected = 0;
+    uint32_t items[16];
+    while(expected < count) {
+        size_t popped = queue.pop(items, 16);
+        if(popped == 0) {
+            std::this_thread::yield();
+        }
+        for(size_t i = 0; i < popped; i++) {
+            if(items[i] != expected) {
+                success = false;
+            }
+            expected++;
+        }
+    }
+
+    producer.join();
+    return success && queue.empty();
+}
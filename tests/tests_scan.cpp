@@ -0,0 +1,26 @@
+#include <iostream>
+#include <voice_scan.h>
+
+using namespace VoiceAllocator;
+
+bool test_scan_find_byte_matches_scalar() {
+    uint8_t data[300];
+    for(size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i % 127);
+    }
+
+    bool success = true;
+    for(size_t size = 0; size <= sizeof(data); size += 7) {
+        for(size_t value = 0; value < 130; value++) {
+            size_t expected = Scan::find_byte_scalar(data, size, (uint8_t)value);
+            size_t result = Scan::find_byte(data, size, (uint8_t)value);
+            if(result != expected) {
+                std::cout << "size " << size << " value " << value << ": " << result
+                          << " != " << expected << std::endl;
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}